@@ -24,6 +24,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
 
 #define GLM_FORCE_RADIANS
 
@@ -41,9 +44,27 @@
 #include "source/LoadShader.h"    /* Loading function for shader code */
 #include "source/OBJParser.h"     /* Loading function for triangle meshes in OBJ format */
 #include "source/LoadTexture.h"
+#include "source/CpuProfiler.h"   /* Scoped CPU timers */
 //};
 
 #include "source/DrawObject.hpp"
+#include "source/FrameRing.hpp"
+#include "source/Frustum.hpp"
+#include "source/GpuProfiler.hpp"
+#include "source/Headless.hpp"
+#include "source/ImageCompare.hpp"
+#include "source/ProgramCache.hpp"
+#include "source/ShaderVariants.hpp"
+#include "source/LightClusters.hpp"
+#include "source/GBuffer.hpp"
+#include "source/DepthPrepass.hpp"
+#include "source/ShadowMaps.hpp"
+#include "source/Lightmap.hpp"
+#include "source/TextureArrays.hpp"
+#include "source/MaterialTable.hpp"
+#include "source/RenderQueue.hpp"
+#include "source/StateCache.hpp"
+#include "source/UniformBlocks.hpp"
 
 using namespace glm;
 
@@ -53,11 +74,60 @@ using namespace glm;
 DrawObject *carousel = 0, *ground = 0, *back = 0;
 DrawObject *cups[4] = {0, 0, 0, 0};
 
+/* All objects of the scene in drawing order, filled in 'Initialize()' */
+#define MAX_OBJECTS 16
+DrawObject *sceneObjects[MAX_OBJECTS];
+int sceneObjectCount = 0;
+
 /* Strings for loading and storing shader code */
 static const char *VertexShaderString;
 static const char *FragmentShaderString;
 
-GLuint ShaderProgram;
+/* Program variants of the shaders, selected per draw by lighting terms and texturing */
+ShaderVariants *shaderVariants = 0;
+
+/* Deferred shading ('--deferred'): the scene is drawn into the G-buffer, then one fullscreen
+ * lighting pass shades every pixel once with the lights of its cluster */
+bool deferredShading = false;
+GBuffer *gBuffer = 0;
+ShaderVariants *lightingVariants = 0;
+static const char *LightingVertexShaderString;
+static const char *LightingFragmentShaderString;
+
+/* Depth pre-pass ('--prepass on|off|auto'): position only draws lay down the depth, so the
+ * shading pass only shades visible fragments; in auto mode the measured overdraw decides */
+DepthPrepassMode depthPrepassMode = DepthPrepassAuto;
+DepthPrepass *depthPrepass = 0;
+ShaderVariants *depthVariants = 0;
+static const char *DepthVertexShaderString;
+static const char *DepthFragmentShaderString;
+
+/* Shadows of the two fixed lights, off unless '--shadows' is given since they cost more than the
+ * rest of the frame on software rasterizers; the ground is a static caster, so light 1, which never
+ * moves, keeps it in a cached map and only the faces that see dynamic casters are redrawn every frame */
+bool shadowMapping = false;
+ShadowMaps *shadowMaps = 0;
+std::vector<DrawObject *> staticCasters, dynamicCasters;
+
+/* Light 1 and the ground never move either, so the diffuse light that light 1 casts onto the
+ * ground is baked into a lightmap at load time ('--no-lightmap' turns that off) */
+bool lightmapping = true;
+
+/* Linked program binaries from earlier runs */
+#define PROGRAM_CACHE_DIRECTORY "shadercache"
+ProgramCache *programCache = 0;
+
+/* Triple buffered ring for per frame and per object uniform data */
+FrameRing *frameRing = 0;
+
+/* Materials of all objects, indexed per vertex in the shaders */
+MaterialTable *materialTable = 0;
+
+/* GPU timer queries around the passes of 'Display()' */
+GpuProfiler *gpuProfiler = 0;
+
+/* Visible objects of the current frame, sorted by state */
+RenderQueue renderQueue;
 
 
 /* Matrices for uniform variables in vertex shader */
@@ -67,6 +137,9 @@ mat4 ProjectionMatrix;
 /* Camera view matrix */
 mat4 ViewMatrix;
 
+/* Far clipping plane, also used to normalize draw depths */
+float farPlane = 50.0;
+
 /* Transformation matrices for model rotation */
 mat4 TranslationMatrixUp;
 mat4 TranslationMatrixDown;
@@ -88,22 +161,176 @@ mat4 lightMatrix2 = mat4(1);
 vec4 lightIntensity2 = vec4(0.5, 0.5, 0.5, 1);
 DrawObject *light2 = 0;
 
-//ambient diffuse and specular terms for turning them on and off;
-float ambient = 1, diffuse = 1, specular = 1;
+//ambient diffuse and specular terms for turning them on and off; disabled terms are compiled out
+bool ambient = true, diffuse = true, specular = true;
+
+/* Lights in the light block, compiled into the program variants */
+int lightCount = MAX_LIGHTS;
+
+/* All lights of the scene: the two above, lights from the OBJ files and '--lights' extra ones.
+ * With more than MAX_LIGHTS lights (or '--clustered') they are binned into the cluster grid */
+#define EXTRA_LIGHT_RANGE 2.0f
+std::vector<SceneLight> sceneLights;
+LightClusters *lightClusters = 0;
+bool clusteredLighting = false;
+int extraLights = 0;
+
+/* Level of detail selection: allowed geometric error in pixels, and pixels per world unit at distance 1 */
+float lodThreshold = 1.0f;
+float lodPixelScale;
 
 
 /* Structures for loading of OBJ data */
 obj_scene_data data;
 
-/* Texture */
+/* Textures */
 
-TextureData *Texture;
-GLuint TextureID;
-GLint TextureUniform;
+/* The textures of all materials are packed into arrays by format and size, meshes with uvs whose
+ * materials have no texture of their own (map_Ka) use TEXTURE_FILE; baked textures are loaded by
+ * worker threads and uploaded a share per frame. 't' (or '--reload-texture n' every n frames of
+ * the benchmark) loads the baked textures again into new arrays, which replace the old ones once
+ * they are complete */
+#define TEXTURE_FILE "data/uvtemplate.bmp"
+TextureArrays *textureArrays = 0;
+TextureStreamer *textureStreamer = 0;
+int reloadInterval = 0;
+
+/* Window (or offscreen framebuffer) size */
+int windowWidth = 600, windowHeight = 600;
 
 /* Reference time for animation */
 int oldTime = 0;
 
+/* Headless benchmark: frames to measure (0 when running interactively), after BENCHMARK_WARMUP
+ * unmeasured frames; animation time advances by exactly BENCHMARK_FRAME_TIME ms per frame */
+#define BENCHMARK_FRAMES 500
+#define BENCHMARK_WARMUP 20
+#define BENCHMARK_FRAME_TIME 16
+int benchmarkFrames = 0;
+int benchmarkTime = 0;
+float benchmarkMean, benchmarkP50, benchmarkP99;
+
+/* Regression gate: measured frames read back and compared against the reference images in
+ * goldenDirectory (or stored into recordDirectory), and the allowed slowdown against the
+ * recorded timings, as a fraction */
+#define GOLDEN_FRAME_COUNT 3
+#define GOLDEN_FRAMES {0, 60, 180}
+#define MAX_SLOWDOWN 0.10f
+const char *goldenDirectory = 0;
+const char *recordDirectory = 0;
+float maxSlowdown = MAX_SLOWDOWN;
+bool imagesPassed = true;
+
+/* Chrome trace of the CPU timers, written at exit if set */
+const char *cpuTraceFile = 0;
+
+/* Frame statistics, summed up and printed every STATS_INTERVAL milliseconds */
+#define STATS_INTERVAL 5000
+int statsTime = 0, statsFrames = 0, statsDraws = 0;
+long statsIssued = 0, statsEliminated = 0;
+
+/******************************************************************
+*
+* ElapsedTime
+*
+* Milliseconds since startup for animation and statistics; in the
+* benchmark this is the deterministic frame time instead
+*
+*******************************************************************/
+
+int ElapsedTime() {
+    if (benchmarkFrames > 0)
+        return benchmarkTime;
+    return glutGet(GLUT_ELAPSED_TIME);
+}
+
+
+/******************************************************************
+*
+* UpdateFrameStats
+*
+* Adds the state cache counters of the current frame to the
+* statistics and prints per frame averages every STATS_INTERVAL
+* milliseconds
+*
+*******************************************************************/
+
+void UpdateFrameStats(int draws) {
+    statsFrames++;
+    statsDraws += draws;
+    statsIssued += stateCache.issued;
+    statsEliminated += stateCache.eliminated;
+    stateCache.resetStats();
+
+    /* The benchmark reports its own averages over the whole run */
+    int time = ElapsedTime();
+    if (benchmarkFrames > 0 || time - statsTime < STATS_INTERVAL)
+        return;
+
+    printf("Frame stats: %.1f fps, %.1f draws, %.1f GL state calls, %.1f redundant calls eliminated per frame\n",
+           statsFrames * 1000.0f / (time - statsTime), (float) statsDraws / statsFrames,
+           (float) statsIssued / statsFrames, (float) statsEliminated / statsFrames);
+    gpuProfiler->log();
+
+    statsTime = time;
+    statsFrames = statsDraws = 0;
+    statsIssued = statsEliminated = 0;
+}
+
+
+/******************************************************************
+*
+* ReloadTexture
+*
+* Starts loading the baked texture files again, e.g. after baking
+* them once more; frames keep using the current arrays meanwhile
+*
+*******************************************************************/
+
+void ReloadTexture() {
+    if (!textureArrays->reloading())
+        textureArrays->reload(*textureStreamer);
+}
+
+/******************************************************************
+*
+* FinishTextureReload
+*
+* Replaces the arrays with the reloaded ones once the streamer is
+* done with them
+*
+*******************************************************************/
+
+void FinishTextureReload() {
+    std::vector<std::pair<GLuint, GLuint> > replaced;
+    if (!textureArrays->finishReload(*textureStreamer, replaced))
+        return;
+
+    for (size_t r = 0; r < replaced.size(); r++)
+        for (int i = 0; i < sceneObjectCount; i++)
+            if (sceneObjects[i]->Texture == replaced[r].first)
+                sceneObjects[i]->Texture = replaced[r].second;
+}
+
+
+/******************************************************************
+*
+* FinishShaderVariants
+*
+* Waits for the shader variants still compiling before exiting, so
+* that all of them end up in the program cache for the next start
+*
+*******************************************************************/
+
+void FinishShaderVariants() {
+    shaderVariants->finishAll();
+    if (lightingVariants)
+        lightingVariants->finishAll();
+    if (depthVariants)
+        depthVariants->finishAll();
+}
+
+
 /******************************************************************
 *
 * Display
@@ -116,100 +343,174 @@ int oldTime = 0;
 *******************************************************************/
 
 void Display() {
-    /* Clear window; color specified in 'Initialize()' */
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    /* Activate first (and only) texture unit */
-    glActiveTexture(GL_TEXTURE0);
+    CPU_PROFILE_SCOPE("Display");
 
-    /* Bind current texture  */
-    glBindTexture(GL_TEXTURE_2D, TextureID);
+    /* Collect old timer results and time the whole frame */
+    gpuProfiler->beginFrame();
+    int frameScope = gpuProfiler->begin("frame");
 
-    /* Get texture uniform handle from fragment shader */
-//    TextureUniform = glGetUniformLocation(ShaderProgram, "textureSampler");
-//    if(TextureUniform == -1){
-//        fprintf(stderr, "Could not bind uniform textureSampler");
-//        exit(-1);
-//    }
-
-    /* Set location of uniform sampler variable */
-    glUniform1i(TextureUniform, 0);
-
-    GLint size;
-    glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-
-    /* Associate program with uniform shader matrices */
-    GLint PVMatrixID = glGetUniformLocation(ShaderProgram, "ProjectionViewMatrix");
-    if (PVMatrixID == -1) {
-        fprintf(stderr, "Could not bind uniform ProjectionViewMatrix\n");
-        exit(-1);
+    /* Clear window; color specified in 'Initialize()' */
+    int clearScope = gpuProfiler->begin("clear");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    gpuProfiler->end(clearScope);
+
+    /* Activate first (and only) texture unit; textures are bound by the render queue, the
+     * samplers and the (fixed) camera matrices are set once per program in 'SetupProgram()' */
+    stateCache.activeTexture(GL_TEXTURE0);
+
+    /* Start writing into this frame's region of the uniform ring */
+    frameRing->beginFrame();
+
+    /* Upload this frame's share of the textures being loaded */
+    textureStreamer->update();
+    if (textureArrays->reloading())
+        FinishTextureReload();
+
+    /* Check and cache the shader variants the driver has finished meanwhile */
+    shaderVariants->update();
+    if (lightingVariants)
+        lightingVariants->update();
+    if (depthVariants)
+        depthVariants->update();
+
+    /* upload lights */
+    //light 1 (immobile, changable colors), light 2 (mobile, fixed color)
+    sceneLights[0].intensity = lightIntensity1;
+    sceneLights[1].position = vec3(lightMatrix2 * initialLightPosition2);
+
+    /* Lighting terms switched off with the a, d and s keys are compiled out of the programs */
+    int features = (ambient ? ShaderAmbient : 0) | (diffuse ? ShaderDiffuse : 0) | (specular ? ShaderSpecular : 0);
+    int shadowFeatures = shadowMapping ? ShaderShadowed : 0;
+    int variantLights = lightCount;
+
+    /* Camera, lights and cluster grid go into one block shared by all programs */
+    mat4 ProjectionViewMatrix = ProjectionMatrix * ViewMatrix;
+    FrameData frameData;
+    frameData.InverseProjectionViewMatrix = inverse(ProjectionViewMatrix);
+    frameData.CameraPosition = vec4(0, cameraDispositionY, cameraDispositionZ, 1);
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        frameData.lights[i].position = vec4(sceneLights[i].position, 1);
+        frameData.lights[i].intensity = sceneLights[i].intensity;
     }
-    glUniformMatrix4fv(PVMatrixID, 1, GL_FALSE, value_ptr(ProjectionMatrix * ViewMatrix));
-
-    /* associate program with light */
-    //light 1 (immobile, changable colors)
-    GLint lP1ID = glGetUniformLocation(ShaderProgram, "lP1");
-    if (lP1ID == -1) {
-        fprintf(stderr, "Could not bind uniform lightPosition1 1\n");
-        exit(-1);
+    frameData.shadowDepth = ShadowMaps::depthParameters();
+
+    if (clusteredLighting || deferredShading) {
+        /* Bin all scene lights into the cluster grid */
+        CPU_PROFILE_BEGIN("cluster lights");
+        lightClusters->update(sceneLights, ViewMatrix, ProjectionMatrix);
+        lightClusters->bind();
+        frameData.clusters = lightClusters->blockData(windowWidth, windowHeight);
+        CPU_PROFILE_END();
+
+        variantLights = 0;
+    } else {
+        frameData.clusters = ClusterData();
     }
-    glUniform3fv(lP1ID, 1, value_ptr(lightPosition1));
-    GLint lI1ID = glGetUniformLocation(ShaderProgram, "lI1");
-    if (lI1ID == -1) {
-        fprintf(stderr, "Could not bind uniform lightIntensity 1\n");
-        exit(-1);
+    frameRing->upload(FrameBinding, &frameData, sizeof(frameData));
+
+    /* The deferred geometry pass only fills the G-buffer, the lighting terms apply in the lighting pass */
+    int geometryFeatures = features | (clusteredLighting ? ShaderClustered : 0) | shadowFeatures;
+    if (deferredShading)
+        geometryFeatures = ShaderDeferred;
+
+    /* Cull bounding spheres against the view frustum, four objects at a time */
+    CPU_PROFILE_BEGIN("cull and queue");
+    Frustum frustum = extractFrustum(ProjectionViewMatrix);
+    float sphereX[MAX_OBJECTS], sphereY[MAX_OBJECTS], sphereZ[MAX_OBJECTS], sphereRadius[MAX_OBJECTS];
+    unsigned char visible[MAX_OBJECTS];
+    for (int i = 0; i < sceneObjectCount; i++) {
+        vec3 center;
+        sceneObjects[i]->worldBoundingSphere(center, sphereRadius[i]);
+        sphereX[i] = center.x;
+        sphereY[i] = center.y;
+        sphereZ[i] = center.z;
     }
-    glUniform4fv(lI1ID, 1, value_ptr(lightIntensity1));
-
-    //light 2 (mobile, fixed color)
-    vec4 currentLightPosition2 = lightMatrix2 * initialLightPosition2;
-    vec3 lP2 = vec3(currentLightPosition2.x, currentLightPosition2.y, currentLightPosition2.z);
-    GLint lP2ID = glGetUniformLocation(ShaderProgram, "lP2");
-    if (lP2ID == -1) {
-        fprintf(stderr, "Could not bind uniform lightPosition 2\n");
-        exit(-1);
+    cullSpheres(frustum, sphereX, sphereY, sphereZ, sphereRadius, sceneObjectCount, visible);
+
+    /* Queue visible objects at the level of detail matching their distance */
+    vec3 cameraPosition = vec3(0, cameraDispositionY, cameraDispositionZ);
+    renderQueue.clear();
+    for (int i = 0; i < sceneObjectCount; i++) {
+        if (!visible[i])
+            continue;
+
+        /* Boxes are tighter than spheres for flat objects like the ground */
+        vec3 boxMin, boxMax;
+        sceneObjects[i]->worldBoundingBox(boxMin, boxMax);
+        if (!boxVisible(frustum, boxMin, boxMax))
+            continue;
+
+        sceneObjects[i]->selectLod(cameraPosition, lodPixelScale, lodThreshold);
+
+        float depth = -(ViewMatrix * vec4(sphereX[i], sphereY[i], sphereZ[i], 1)).z;
+        int objectFeatures = geometryFeatures | (sceneObjects[i]->Texture != 0 ? ShaderTextured : 0);
+        /* The G-buffer has no room for baked light, the deferred lighting pass shades the ground fully */
+        if (sceneObjects[i]->Lightmap != 0 && !deferredShading)
+            objectFeatures |= ShaderLightmapped;
+        /* Variants still compiling are stood in for by the one with all terms (the same in deferred mode) */
+        int fallbackFeatures = objectFeatures | (deferredShading ? 0 : SHADER_LIGHTING_TERMS);
+        GLuint program = shaderVariants->select(objectFeatures, variantLights, fallbackFeatures);
+        renderQueue.add(sceneObjects[i], program, depth / farPlane);
     }
-    glUniform3fv(lP2ID, 1, value_ptr(lP2));
-
-    GLint lI2ID = glGetUniformLocation(ShaderProgram, "lI2");
-    if (lI2ID == -1) {
-        fprintf(stderr, "Could not bind uniform lightIntenstity 2\n");
-        exit(-1);
+    CPU_PROFILE_END();
+
+    /* Shadow maps of the fixed lights, before any scene pass binds its framebuffer */
+    if (shadowMapping) {
+        CPU_PROFILE_BEGIN("shadows");
+        int shadowScope = gpuProfiler->begin("shadows");
+        vec3 shadowLights[SHADOW_LIGHTS] = {sceneLights[0].position, sceneLights[1].position};
+        shadowMaps->update(shadowLights, staticCasters, dynamicCasters, *frameRing, depthVariants->get(0, 0),
+                           windowWidth, windowHeight);
+        shadowMaps->bind();
+        gpuProfiler->end(shadowScope);
+        CPU_PROFILE_END();
     }
-    glUniform4fv(lI2ID, 1, value_ptr(lightIntensity2));
 
-    //lighting components
-    GLint ambientID = glGetUniformLocation(ShaderProgram, "showAmbient");
-    if (ambientID == -1) {
-        fprintf(stderr, "Could not bind uniform showAmbient\n");
-        exit(-1);
+    /* Draw sorted by state, skipping redundant binds */
+    renderQueue.sort();
+    CPU_PROFILE_BEGIN("draw");
+    if (deferredShading)
+        gBuffer->beginGeometry();
+
+    /* Lay down the depth first if overdraw makes that worth it */
+    bool prepass = depthPrepass->beginFrame();
+    if (prepass) {
+        int depthScope = gpuProfiler->begin("depth");
+        renderQueue.drawDepth(*frameRing, ProjectionViewMatrix, depthVariants->get(0, 0));
+        gpuProfiler->end(depthScope);
     }
-    glUniform1f(ambientID, ambient);
 
-    GLint diffuseID = glGetUniformLocation(ShaderProgram, "showDiffuse");
-    if (diffuseID == -1) {
-        fprintf(stderr, "Could not bind uniform showDiffuse\n");
-        exit(-1);
+    int sceneScope = gpuProfiler->begin(deferredShading ? "geometry" : "scene");
+    depthPrepass->beginShading();
+    renderQueue.draw(*frameRing, ProjectionViewMatrix, gpuProfiler);
+    depthPrepass->endShading();
+    gpuProfiler->end(sceneScope);
+    CPU_PROFILE_END();
+
+    /* Shade the G-buffer into the window in one fullscreen pass */
+    if (deferredShading) {
+        int lightingScope = gpuProfiler->begin("lighting");
+        gBuffer->beginLighting();
+        stateCache.useProgram(lightingVariants->select(features | shadowFeatures, 0,
+                                                       SHADER_LIGHTING_TERMS | shadowFeatures));
+        stateCache.disable(GL_DEPTH_TEST);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        stateCache.enable(GL_DEPTH_TEST);
+        gpuProfiler->end(lightingScope);
     }
-    glUniform1f(diffuseID, diffuse);
 
-    GLint specularID = glGetUniformLocation(ShaderProgram, "showSpecular");
-    if (specularID == -1) {
-        fprintf(stderr, "Could not bind uniform showSpecular\n");
-        exit(-1);
-    }
-    glUniform1f(specularID, specular);
+    /* Fence this frame's region so it is only reused once the GPU is done with it */
+    frameRing->endFrame();
 
+    gpuProfiler->end(frameScope);
+    gpuProfiler->endFrame();
 
-    /* Draw objects */
-    ground->draw(ShaderProgram);
-    carousel->draw(ShaderProgram);
-    for (int i = 0; i < 4; i++)
-        cups[i]->draw(ShaderProgram);
-    light2->draw(ShaderProgram);
+    /* Sum up the frame statistics */
+    UpdateFrameStats(renderQueue.size() * (prepass ? 2 : 1));
 
     /* Swap between front and back buffer */
-    glutSwapBuffers();
+    if (benchmarkFrames == 0)
+        glutSwapBuffers();
 }
 
 
@@ -242,6 +543,7 @@ void Keyboard(unsigned char key, int x, int y) {
             lightIntensity1[2] = !lightIntensity1[2];
             break;
         case 'c':
+            FinishShaderVariants();
             exit(0);
         case 'a':
             ambient = !ambient;
@@ -250,7 +552,22 @@ void Keyboard(unsigned char key, int x, int y) {
             diffuse = !diffuse;
             break;
         case 's':
-            specular = !diffuse;
+            specular = !specular;
+            break;
+        case '+':
+            lodThreshold *= 2;
+            printf("LOD threshold: %g pixels\n", lodThreshold);
+            break;
+        case '-':
+            lodThreshold /= 2;
+            printf("LOD threshold: %g pixels\n", lodThreshold);
+            break;
+        case 't':
+            ReloadTexture();
+            break;
+        case 'o':
+            gpuProfiler->perObject = !gpuProfiler->perObject;
+            printf("Per object GPU timing: %s\n", gpuProfiler->perObject ? "on" : "off");
             break;
         default:
             break;
@@ -276,8 +593,10 @@ void KeyUp(unsigned char key, int x, int y) {
 *******************************************************************/
 
 void OnIdle() {
+    CPU_PROFILE_SCOPE("OnIdle");
+
     /* Determine delta time between two frames to ensure constant animation */
-    int newTime = glutGet(GLUT_ELAPSED_TIME);
+    int newTime = ElapsedTime();
     int delta = newTime - oldTime;
     oldTime = newTime;
 
@@ -307,144 +626,268 @@ void OnIdle() {
 
 
     /* Issue display refresh */
-    glutPostRedisplay();
+    if (benchmarkFrames == 0)
+        glutPostRedisplay();
 }
 
 /******************************************************************
 *
-* AddShader
+* BindUniformBlock
 *
-* This function creates and adds individual shaders
+* This function connects a named uniform block of the shader program
+* to one of the fixed binding points the frame ring uploads to;
+* optional blocks may be compiled out of some program variants
 *
 *******************************************************************/
 
-void AddShader(GLuint ShaderProgram, const char *ShaderCode, GLenum ShaderType) {
-    /* Create shader object */
-    GLuint ShaderObj = glCreateShader(ShaderType);
-
-    if (ShaderObj == 0) {
-        fprintf(stderr, "Error creating shader type %d\n", ShaderType);
-        exit(0);
+void BindUniformBlock(GLuint ShaderProgram, const char *BlockName, GLuint Binding, bool Optional = false) {
+    GLuint BlockIndex = glGetUniformBlockIndex(ShaderProgram, BlockName);
+    if (BlockIndex == GL_INVALID_INDEX && Optional)
+        return;
+    if (BlockIndex == GL_INVALID_INDEX) {
+        fprintf(stderr, "Could not find uniform block %s\n", BlockName);
+        exit(-1);
     }
+    glUniformBlockBinding(ShaderProgram, BlockIndex, Binding);
+}
 
-    /* Associate shader source code string with shader object */
-    glShaderSource(ShaderObj, 1, &ShaderCode, NULL);
-
-    GLint success = 0;
-    GLchar InfoLog[1024];
 
-    /* Compile shader source code */
-    glCompileShader(ShaderObj);
-    glGetShaderiv(ShaderObj, GL_COMPILE_STATUS, &success);
+/******************************************************************
+*
+* SetupShadowSamplers
+*
+* This function points the shadow map samplers of the current
+* program at their texture units, if the variant has shadows
+*
+*******************************************************************/
 
-    if (!success) {
-        glGetShaderInfoLog(ShaderObj, 1024, NULL, InfoLog);
-        fprintf(stderr, "Error compiling shader type %d: '%s'\n", ShaderType, InfoLog);
-        exit(1);
+void SetupShadowSamplers(GLuint program) {
+    const char *ShadowSamplers[SHADOW_LIGHTS] = {"shadowSampler0", "shadowSampler1"};
+    for (int i = 0; i < SHADOW_LIGHTS; i++) {
+        GLint SamplerUniform = glGetUniformLocation(program, ShadowSamplers[i]);
+        if (SamplerUniform != -1)
+            stateCache.uniform1i(SamplerUniform, SHADOW_TEXTURE_UNIT + i);
     }
-
-    /* Associate shader with shader program */
-    glAttachShader(ShaderProgram, ShaderObj);
 }
 
 
 /******************************************************************
 *
-* CreateShaderProgram
+* SetupProgram
 *
-* This function creates the shader program; vertex and fragment
-* shaders are loaded and linked into program; final shader program
-* is put into the rendering pipeline 
+* This function prepares a freshly linked program variant: uniform
+* blocks are connected to the frame ring binding points and the
+* samplers are assigned their texture units
 *
 *******************************************************************/
 
-void CreateShaderProgram() {
-    /* Allocate shader object */
-    ShaderProgram = glCreateProgram();
+void SetupProgram(GLuint program) {
+    GLint Success = 0;
+    GLchar ErrorLog[1024];
 
-    if (ShaderProgram == 0) {
-        fprintf(stderr, "Error creating shader program\n");
+    /* Connect uniform blocks to the frame ring binding points */
+    BindUniformBlock(program, "ObjectBlock", ObjectBinding);
+    BindUniformBlock(program, "MaterialBlock", MaterialBinding);
+
+    /* G-buffer variants use nothing of the frame block */
+    BindUniformBlock(program, "FrameBlock", FrameBinding, true);
+
+    stateCache.useProgram(program);
+
+    /* Only textured variants sample, the texture is on the first unit */
+    GLint TextureUniform = glGetUniformLocation(program, "textureSampler");
+    if (TextureUniform != -1)
+        stateCache.uniform1i(TextureUniform, 0);
+
+    /* Clustered variants read lights and clusters from texture buffers */
+    const char *ClusterSamplers[3] = {"lightSampler", "clusterSampler", "lightIndexSampler"};
+    GLint ClusterUnits[3] = {LIGHT_TEXTURE_UNIT, CLUSTER_TEXTURE_UNIT, LIGHT_INDEX_TEXTURE_UNIT};
+    for (int i = 0; i < 3; i++) {
+        GLint SamplerUniform = glGetUniformLocation(program, ClusterSamplers[i]);
+        if (SamplerUniform != -1)
+            stateCache.uniform1i(SamplerUniform, ClusterUnits[i]);
+    }
+
+    /* Shadowed variants read the cube maps of the fixed lights, lightmapped ones the baked light */
+    SetupShadowSamplers(program);
+    GLint LightmapUniform = glGetUniformLocation(program, "lightmapSampler");
+    if (LightmapUniform != -1)
+        stateCache.uniform1i(LightmapUniform, LIGHTMAP_TEXTURE_UNIT);
+
+    /* Check if shader program can be executed */
+    glValidateProgram(program);
+    glGetProgramiv(program, GL_VALIDATE_STATUS, &Success);
+
+    if (!Success) {
+        glGetProgramInfoLog(program, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
         exit(1);
     }
+}
 
-    /* Load shader code from file */
-    VertexShaderString = LoadShader("shaders/vertexshader.vs");
-    FragmentShaderString = LoadShader("shaders/fragmentshader.fs");
 
-    /* Separately add vertex and fragment shader to program */
-    AddShader(ShaderProgram, VertexShaderString, GL_VERTEX_SHADER);
-    AddShader(ShaderProgram, FragmentShaderString, GL_FRAGMENT_SHADER);
+/******************************************************************
+*
+* SetupLightingProgram
+*
+* This function prepares a linked variant of the deferred lighting
+* pass: G-buffer and light samplers and the frame block
+*
+*******************************************************************/
 
+void SetupLightingProgram(GLuint program) {
     GLint Success = 0;
     GLchar ErrorLog[1024];
 
-    /* Link shader code into executable shader program */
-    glLinkProgram(ShaderProgram);
+    BindUniformBlock(program, "FrameBlock", FrameBinding);
+    stateCache.useProgram(program);
+
+    /* G-buffer targets and depth follow each other from GBUFFER_TEXTURE_UNIT on */
+    const char *Samplers[7] = {"albedoSampler", "normalSampler", "ambientSampler", "depthSampler",
+                               "lightSampler", "clusterSampler", "lightIndexSampler"};
+    GLint Units[7] = {GBUFFER_TEXTURE_UNIT, GBUFFER_TEXTURE_UNIT + 1, GBUFFER_TEXTURE_UNIT + 2,
+                      GBUFFER_TEXTURE_UNIT + 3, LIGHT_TEXTURE_UNIT, CLUSTER_TEXTURE_UNIT, LIGHT_INDEX_TEXTURE_UNIT};
+    for (int i = 0; i < 7; i++) {
+        GLint SamplerUniform = glGetUniformLocation(program, Samplers[i]);
+        if (SamplerUniform != -1)
+            stateCache.uniform1i(SamplerUniform, Units[i]);
+    }
+    SetupShadowSamplers(program);
 
-    /* Check results of linking step */
-    glGetProgramiv(ShaderProgram, GL_LINK_STATUS, &Success);
+    /* Check if shader program can be executed */
+    glValidateProgram(program);
+    glGetProgramiv(program, GL_VALIDATE_STATUS, &Success);
 
-    if (Success == 0) {
-        glGetProgramInfoLog(ShaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
-        fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
+    if (!Success) {
+        glGetProgramInfoLog(program, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Invalid lighting program: '%s'\n", ErrorLog);
         exit(1);
     }
+}
+
+
+/******************************************************************
+*
+* SetupDepthProgram
+*
+* This function prepares the linked program of the depth pre-pass,
+* which only reads the object block
+*
+*******************************************************************/
+
+void SetupDepthProgram(GLuint program) {
+    GLint Success = 0;
+    GLchar ErrorLog[1024];
+
+    BindUniformBlock(program, "ObjectBlock", ObjectBinding);
 
     /* Check if shader program can be executed */
-    glValidateProgram(ShaderProgram);
-    glGetProgramiv(ShaderProgram, GL_VALIDATE_STATUS, &Success);
+    glValidateProgram(program);
+    glGetProgramiv(program, GL_VALIDATE_STATUS, &Success);
 
     if (!Success) {
-        glGetProgramInfoLog(ShaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
-        fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
+        glGetProgramInfoLog(program, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Invalid depth program: '%s'\n", ErrorLog);
         exit(1);
     }
-
-    /* Put linked shader program into drawing pipeline */
-    glUseProgram(ShaderProgram);
 }
 
-void SetupTexture() {
-    /* Allocate texture container */
-    Texture = (TextureData *) malloc(sizeof(TextureData *));
 
-    int success = LoadTexture("data/uvtemplate.bmp", Texture);
-    if (!success) {
-        printf("Error loading texture. Exiting.\n");
-        exit(-1);
+/******************************************************************
+*
+* CreateShaderProgram
+*
+* This function loads the vertex and fragment shaders and starts
+* compiling the program variants for every combination of lighting
+* terms at once; only the variants with all terms, which stand in
+* for the others until they are done, are waited for here
+*
+*******************************************************************/
+
+void CreateShaderProgram() {
+    CPU_PROFILE_SCOPE("CreateShaderProgram");
+
+    /* Load shader code from file */
+    VertexShaderString = LoadShader("shaders/vertexshader.vs");
+    FragmentShaderString = LoadShader("shaders/fragmentshader.fs");
+
+    shaderVariants = new ShaderVariants(VertexShaderString, FragmentShaderString, *programCache, SetupProgram);
+    int shadowed = shadowMapping ? ShaderShadowed : 0;
+    int features = (clusteredLighting ? ShaderClustered : 0) | shadowed;
+    int lights = clusteredLighting ? 0 : lightCount;
+    if (deferredShading) {
+        /* The geometry pass has no lighting terms, the lighting pass gets them */
+        shaderVariants->request(ShaderDeferred, 0);
+        shaderVariants->request(ShaderDeferred | ShaderTextured, 0);
+
+        LightingVertexShaderString = LoadShader("shaders/deferred.vs");
+        LightingFragmentShaderString = LoadShader("shaders/deferred.fs");
+        lightingVariants = new ShaderVariants(LightingVertexShaderString, LightingFragmentShaderString,
+                                              *programCache, SetupLightingProgram);
+        for (int terms = 0; terms <= SHADER_LIGHTING_TERMS; terms += ShaderAmbient)
+            lightingVariants->request(terms | shadowed, 0);
+    } else {
+        for (int terms = 0; terms <= SHADER_LIGHTING_TERMS; terms += ShaderAmbient) {
+            shaderVariants->request(features | terms, lights);
+            shaderVariants->request(features | terms | ShaderTextured, lights);
+            if (lightmapping)
+                shaderVariants->request(features | terms | ShaderLightmapped, lights);
+        }
     }
 
-    /* Create texture name and store in handle */
-    glGenTextures(1, &TextureID);
+    /* The depth pre-pass and the shadow maps share a single program */
+    if (depthPrepassMode != DepthPrepassOff || shadowMapping) {
+        DepthVertexShaderString = LoadShader("shaders/depth.vs");
+        DepthFragmentShaderString = LoadShader("shaders/depth.fs");
+        depthVariants = new ShaderVariants(DepthVertexShaderString, DepthFragmentShaderString, *programCache,
+                                           SetupDepthProgram);
+        depthVariants->request(0, 0);
+    }
 
-    /* Bind texture */
-    glBindTexture(GL_TEXTURE_2D, TextureID);
+    /* Block only on the fallbacks */
+    if (deferredShading) {
+        shaderVariants->get(ShaderDeferred, 0);
+        shaderVariants->get(ShaderDeferred | ShaderTextured, 0);
+        lightingVariants->get(SHADER_LIGHTING_TERMS | shadowed, 0);
+    } else {
+        shaderVariants->get(features | SHADER_LIGHTING_TERMS, lights);
+        shaderVariants->get(features | SHADER_LIGHTING_TERMS | ShaderTextured, lights);
+        if (lightmapping)
+            shaderVariants->get(features | SHADER_LIGHTING_TERMS | ShaderLightmapped, lights);
+    }
 
-    /* Load texture image into memory */
-    glTexImage2D(GL_TEXTURE_2D,     /* Target texture */
-                 0,                 /* Base level */
-                 GL_RGB,            /* Each element is RGB triple */
-                 Texture->width,    /* Texture dimensions */
-                 Texture->height,
-                 0,                 /* Border should be zero */
-                 GL_BGR,            /* Data storage format for BMP file */
-                 GL_UNSIGNED_BYTE,  /* Type of pixel data, one byte per channel */
-                 Texture->data);    /* Pointer to image data  */
+    int pending = shaderVariants->pendingCount() + (lightingVariants ? lightingVariants->pendingCount() : 0) +
+                  (depthVariants ? depthVariants->pendingCount() : 0);
+    printf("Shader programs: %d from cache, %d compiled (%d still compiling), %d rejected by the driver\n",
+           programCache->hits, programCache->misses, pending, programCache->rejected);
+}
 
-    /* Next set up texturing parameters */
+/******************************************************************
+*
+* SetupTexture
+*
+* Fills the texture arrays the objects added their textures to;
+* baked textures (the .ktx files in data/, see the Makefile) with precomputed
+* and possibly block compressed mip levels go through the texture
+* streamer, waiting for it since the first frame needs them, the
+* BMPs of the others get their mip levels from the driver
+*
+*******************************************************************/
 
-    /* Repeat texture on edges when tiling */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+void SetupTexture() {
+    CPU_PROFILE_SCOPE("SetupTexture");
 
-    /* Linear interpolation for magnification */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    /* Trilinear MIP mapping for minification */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    textureArrays->build(*textureStreamer);
+    textureStreamer->finish();
 
     /* Note: MIP mapping not visible due to fixed, i.e. static camera */
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Textures: %d in %d arrays, %ld KB in %.1f ms\n", textureArrays->layerCount, textureArrays->arrayCount(),
+           textureArrays->bytes / 1024, (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) * 1e-6);
 }
 
 
@@ -460,12 +903,14 @@ void SetupTexture() {
 *******************************************************************/
 
 void Initialize() {
+    CPU_PROFILE_SCOPE("Initialize");
+
     /* Set projection transform */
     float fovy = (float) (45.0 * M_PI / 180.0);
     float aspect = 1.0;
     float nearPlane = 1.0;
-    float farPlane = 50.0;
     ProjectionMatrix = perspective(fovy, aspect, nearPlane, farPlane);
+    lodPixelScale = windowHeight / (2 * tanf(fovy / 2));
 
     /* Set viewing transform */
     ViewMatrix = lookAt(vec3(0, cameraDispositionY, cameraDispositionZ),    /* Eye vector */
@@ -479,24 +924,43 @@ void Initialize() {
     vec4 groundMaterial[3] = {vec4(0.6f, 0.4f, 0.3f, 1), vec4(0.6f, 0.4f, 0.3f, 1), vec4(1, 1, 1, 1)};
     vec4 cupMaterial[3] = {vec4(0.4f, 0.5f, 0.1f, 1), vec4(0.4f, 0.5f, 0.1f, 1), vec4(1, 1, 1, 1)};
 
+    /* Objects add their materials to the table while loading, and their textures to the arrays */
+    materialTable = new MaterialTable();
+    textureArrays = new TextureArrays();
+    textureArrays->defaultFile = TEXTURE_FILE;
+    materialTable->textures = textureArrays;
+
+    /* The two lights of the scene come first, they are updated every frame */
+    SceneLight fixedLight = {lightPosition1, 0, lightIntensity1};
+    SceneLight carouselLight = {vec3(initialLightPosition2), 0, lightIntensity2};
+    sceneLights.push_back(fixedLight);
+    sceneLights.push_back(carouselLight);
+
     /* Load Objects */
     success = parse_obj_scene(&data, (char *) "models/carousel.obj");
     if (!success)
         printf("Could not load file. Exiting.\n");
-    carousel = new DrawObject(&data, carouselMaterial);
+    carousel = new DrawObject(&data, carouselMaterial, *materialTable);
+    carousel->Name = "carousel";
+    appendObjLights(sceneLights, &data, carousel->InitialTransform);
 
     success = parse_obj_scene(&data, (char *) "models/ground.obj");
     if (!success)
         printf("Could not load file. Exiting.\n");
-    ground = new DrawObject(&data, groundMaterial);
+    ground = new DrawObject(&data, groundMaterial, *materialTable, PackedFormat, lightmapping);
+    ground->Name = "ground";
     ground->InitialTransform = translate(mat4(1), vec3(0, -3.5f, 0));
+    appendObjLights(sceneLights, &data, ground->InitialTransform);
 
     success = parse_obj_scene(&data, (char *) "models/capsule.obj");
     if (!success)
         printf("Could not load file. Exiting.\n");
 
-    for (int i = 0; i < 4; i++) {
-        cups[i] = new DrawObject(&data, cupMaterial);
+    /* The cups are instances of one mesh */
+    cups[0] = new DrawObject(&data, cupMaterial, *materialTable);
+    cups[0]->Name = "cup";
+    for (int i = 1; i < 4; i++) {
+        cups[i] = new DrawObject(cups[0], cupMaterial, *materialTable);
     }
 
     cups[0]->InitialTransform = translate(mat4(1), vec3(4, 0, 0));
@@ -511,38 +975,326 @@ void Initialize() {
         exit(-1);
     }
     vec4 lightMaterial[3] = {vec4(1, 1, 1, 1), vec4(1, 1, 1, 1), vec4(1, 1, 1, 1)};
-    light2 = new DrawObject(&data, lightMaterial);
+    light2 = new DrawObject(&data, lightMaterial, *materialTable);
+    light2->Name = "light";
     light2->InitialTransform = translate(mat4(1), vec3(initialLightPosition2));
 
+    /* Collect objects in drawing order */
+    sceneObjects[sceneObjectCount++] = ground;
+    sceneObjects[sceneObjectCount++] = carousel;
+    for (int i = 0; i < 4; i++)
+        sceneObjects[sceneObjectCount++] = cups[i];
+    sceneObjects[sceneObjectCount++] = light2;
+
     /* Set background (clear) color to Black */
     glClearColor(0.0, 0.0, 0.0, 0.0);
 
     /* Enable depth testing */
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+    stateCache.enable(GL_DEPTH_TEST);
+    stateCache.depthFunc(GL_LESS);
+
+    /* Extra lights scattered over the scene, for measuring the clustered path */
+    srand(1);
+    for (int i = 0; i < extraLights; i++) {
+        SceneLight light;
+        light.position = vec3(rand() % 2400 / 100.f - 12, rand() % 600 / 100.f - 3.5f, rand() % 2400 / 100.f - 12);
+        light.range = EXTRA_LIGHT_RANGE;
+        light.intensity = vec4(rand() % 100 / 200.f, rand() % 100 / 200.f, rand() % 100 / 200.f, 1);
+        sceneLights.push_back(light);
+    }
 
-    /* Setup shaders and shader program */
-    CreateShaderProgram();
+    /* More lights than the light block holds are binned into the cluster grid */
+    if ((int) sceneLights.size() > MAX_LIGHTS)
+        clusteredLighting = true;
+    if (clusteredLighting || deferredShading) {
+        lightClusters = new LightClusters(nearPlane, farPlane);
+        printf("%s lighting: %d lights in %dx%dx%d clusters\n", deferredShading ? "Deferred" : "Clustered",
+               (int) sceneLights.size(), CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+    }
 
-    GLint cPID = glGetUniformLocation(ShaderProgram, "cP");
-    if (cPID == -1) {
-        fprintf(stderr, "Could not locate uniform CameraPosition");
-        exit(-1);
+    /* The G-buffer replaces the window as target of the scene */
+    if (deferredShading) {
+        gBuffer = new GBuffer(windowWidth, windowHeight);
+        printf("G-buffer: %dx%d, %d bytes per pixel\n", windowWidth, windowHeight, GBuffer::bytesPerPixel());
     }
-    glUniform4fv(cPID, 1, value_ptr(vec4(0, cameraDispositionY, cameraDispositionZ, 1)));
 
-    GLint PVMatrixID = glGetUniformLocation(ShaderProgram, "ProjectionViewMatrix");
-    if (PVMatrixID == -1) {
-        fprintf(stderr, "Could not locate uniform ProjectionViewMatrix\n");
-        exit(-1);
+    /* Shadow casters; the light sphere sits on light 2 and casts nothing */
+    if (shadowMapping) {
+        shadowMaps = new ShadowMaps();
+        shadowMaps->staticPose[0] = true;
+        /* The ground lies below both lights and everything they light, so it can never block
+         * them; it stays out of both maps, and light 1 renders no static cache either */
+        shadowMaps->castStatic[0] = false;
+        shadowMaps->castStatic[1] = false;
+        staticCasters.push_back(ground);
+        dynamicCasters.push_back(carousel);
+        for (int i = 0; i < 4; i++)
+            dynamicCasters.push_back(cups[i]);
+        printf("Shadow maps: %d lights, %d cube faces of %dx%d\n", SHADOW_LIGHTS, 6 * SHADOW_LIGHTS,
+               SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    }
+
+    /* Light 1 on the ground, shadowed and bounced by the static geometry; the ground is the only
+     * static geometry and its top face cannot see any other part of it, so no bounce rays are cast */
+    if (lightmapping) {
+        LightmapBaker baker;
+        baker.bounceSamples = 0;
+        baker.addOccluder(*ground, vec3(groundMaterial[1]));
+        baker.addLight(lightPosition1);
+        baker.build();
+        ground->Lightmap = baker.bake(*ground, LIGHTMAP_SIZE);
+        printf("Lightmap: %dx%d for the ground, %d texels, %ld rays on %d threads in %.1f ms\n", LIGHTMAP_SIZE,
+               LIGHTMAP_SIZE, baker.texels, baker.rays, baker.threads, baker.milliseconds);
     }
-    glUniformMatrix4fv(PVMatrixID, 1, GL_FALSE, value_ptr(ProjectionMatrix * ViewMatrix));
+
+    /* Setup shaders and shader program */
+    programCache = new ProgramCache(PROGRAM_CACHE_DIRECTORY);
+    CreateShaderProgram();
+
+    /* Allocate per frame uniform ring; 64KB per frame leaves room for a few hundred objects */
+    frameRing = new FrameRing(64 * 1024);
+
+    /* Timer queries for the passes, objects are only timed after pressing 'o' */
+    gpuProfiler = new GpuProfiler();
+
+    /* Overdraw in the G-buffer pass only costs writes, in the forward paths it costs lighting */
+    float minOverdraw = DEPTH_PREPASS_MIN_OVERDRAW;
+    if (deferredShading)
+        minOverdraw = DEPTH_PREPASS_MIN_OVERDRAW_DEFERRED;
+    else if (clusteredLighting)
+        minOverdraw = DEPTH_PREPASS_MIN_OVERDRAW_CLUSTERED;
+    depthPrepass = new DepthPrepass(depthPrepassMode, minOverdraw);
+
+    /* Upload the materials of all loaded objects */
+    materialTable->upload();
+    printf("Material table: %d materials\n", materialTable->size());
+    DrawObject::printHeapUsage();
 
     /* set up texture */
+    textureStreamer = new TextureStreamer();
     SetupTexture();
 }
 
 
+/******************************************************************
+*
+* CheckGoldenFrame
+*
+* Reads back the current frame and either stores it as reference
+* image (--record) or compares it against the stored one (--golden)
+*
+*******************************************************************/
+
+void CheckGoldenFrame(int frame) {
+    std::vector<unsigned char> pixels(windowWidth * windowHeight * 3), image(pixels.size());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, windowWidth, windowHeight, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    /* GL rows start at the bottom, image rows at the top */
+    int row = windowWidth * 3;
+    for (int y = 0; y < windowHeight; y++)
+        memcpy(&image[y * row], &pixels[(windowHeight - 1 - y) * row], row);
+
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%s/frame%04d.ppm", recordDirectory ? recordDirectory : goldenDirectory,
+             frame);
+
+    if (recordDirectory) {
+        if (writePPM(filename, windowWidth, windowHeight, image))
+            printf("Recorded %s\n", filename);
+        else
+            imagesPassed = false;
+        return;
+    }
+
+    int width, height;
+    std::vector<unsigned char> reference;
+    if (!readPPM(filename, width, height, reference) || width != windowWidth || height != windowHeight) {
+        fprintf(stderr, "No matching reference image %s\n", filename);
+        imagesPassed = false;
+        return;
+    }
+
+    ImageDifference difference = compareImages(image, reference, width, height, IMAGE_DELTA_E_THRESHOLD);
+    bool passed = difference.changedFraction <= IMAGE_CHANGED_FRACTION;
+    printf("Golden frame %d: mean delta E %.3f, max %.1f, %.3f%% of pixels changed: %s\n", frame,
+           difference.meanDeltaE, difference.maxDeltaE, difference.changedFraction * 100, passed ? "pass" : "FAIL");
+
+    if (!passed) {
+        snprintf(filename, sizeof(filename), "%s/frame%04d.failed.ppm", goldenDirectory, frame);
+        writePPM(filename, windowWidth, windowHeight, image);
+    }
+    imagesPassed = imagesPassed && passed;
+}
+
+
+/******************************************************************
+*
+* RunBenchmark
+*
+* Renders benchmarkFrames frames offscreen with deterministic
+* animation time and prints frame time mean, median and 99th
+* percentile along with draw call and triangle counts
+*
+*******************************************************************/
+
+double Seconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void RunBenchmark() {
+    /* Warm up caches, drivers and the frame ring before measuring */
+    for (int i = 0; i < BENCHMARK_WARMUP; i++) {
+        benchmarkTime += BENCHMARK_FRAME_TIME;
+        OnIdle();
+        Display();
+    }
+    glFinish();
+
+    statsFrames = statsDraws = 0;
+    statsIssued = statsEliminated = 0;
+    depthPrepass->frames = depthPrepass->prepassFrames = 0;
+
+    /* glFinish() makes every frame time include the GPU work of the frame; golden frames are
+     * read back after their time is taken */
+    std::vector<double> frameTimes;
+    long triangles = 0;
+    int goldenFrames[GOLDEN_FRAME_COUNT] = GOLDEN_FRAMES;
+    for (int i = 0; i < benchmarkFrames; i++) {
+        if (reloadInterval > 0 && i % reloadInterval == 0)
+            ReloadTexture();
+
+        double frameStart = Seconds();
+        benchmarkTime += BENCHMARK_FRAME_TIME;
+        OnIdle();
+        Display();
+        glFinish();
+        frameTimes.push_back((Seconds() - frameStart) * 1000);
+        triangles += renderQueue.triangles;
+
+        for (int g = 0; g < GOLDEN_FRAME_COUNT; g++)
+            if (goldenFrames[g] == i && (goldenDirectory || recordDirectory))
+                CheckGoldenFrame(i);
+    }
+
+    int frames = (int) frameTimes.size();
+    double total = 0;
+    for (int i = 0; i < frames; i++)
+        total += frameTimes[i];
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    benchmarkMean = (float) (total / frames);
+    benchmarkP50 = (float) frameTimes[frames / 2];
+    benchmarkP99 = (float) frameTimes[std::min(frames - 1, frames * 99 / 100)];
+
+    printf("Benchmark: %d frames (%d warmup) at %dx%d in %.2f s\n", frames, BENCHMARK_WARMUP, windowWidth,
+           windowHeight, total / 1000);
+    printf("  frame time ms: mean %.3f  p50 %.3f  p99 %.3f  min %.3f  max %.3f\n",
+           benchmarkMean, benchmarkP50, benchmarkP99, frameTimes[0], frameTimes[frames - 1]);
+    printf("  per frame: %.1f draw calls, %.0f triangles, %.1f GL state calls, %.1f redundant calls eliminated\n",
+           (float) statsDraws / frames, (float) triangles / frames, (float) statsIssued / frames,
+           (float) statsEliminated / frames);
+    if (clusteredLighting || deferredShading)
+        printf("  %s lights: %d binned, %d cluster entries, %d dropped\n", deferredShading ? "deferred" : "clustered",
+               lightClusters->lightCount, lightClusters->indexCount, lightClusters->droppedCount);
+    printf("  depth pre-pass %s: used in %d of %d frames", DepthPrepass::modeName(depthPrepass->mode),
+           depthPrepass->prepassFrames, depthPrepass->frames);
+    if (depthPrepass->overdraw() > 0)
+        printf(", overdraw %.2f (pre-pass from %.2f)", depthPrepass->overdraw(), depthPrepass->minOverdraw);
+    printf("\n");
+    if (shadowMapping)
+        printf("  shadows: %d static cube maps rendered, %.1f of %d faces updated and %.1f caster draws per frame\n",
+               shadowMaps->cacheRenders, (float) shadowMaps->faceUpdates / shadowMaps->updates, 6 * SHADOW_LIGHTS,
+               (float) shadowMaps->draws / shadowMaps->updates);
+    if (reloadInterval > 0)
+        printf("  texture streaming: %d textures loaded, %ld KB in %d bands, at most %ld KB per frame\n",
+               textureStreamer->texturesLoaded, textureStreamer->uploadedBytes / 1024, textureStreamer->uploadedBands,
+               textureStreamer->maxFrameBytes / 1024);
+    gpuProfiler->log();
+}
+
+
+/******************************************************************
+*
+* CheckRegression
+*
+* Records or compares the benchmark timings against the baseline
+* in the golden directory and writes the outcome of the gate to
+* benchmark_result.json; returns the process exit status
+*
+*******************************************************************/
+
+int CheckRegression() {
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%s/baseline.txt", recordDirectory ? recordDirectory : goldenDirectory);
+
+    if (recordDirectory) {
+        FILE *file = fopen(filename, "w");
+        if (file == 0) {
+            fprintf(stderr, "Could not write %s\n", filename);
+            return 1;
+        }
+        fprintf(file, "frames %d\nmean %.4f\np50 %.4f\np99 %.4f\n", benchmarkFrames, benchmarkMean, benchmarkP50,
+                benchmarkP99);
+        fclose(file);
+        printf("Recorded %s\n", filename);
+        return imagesPassed ? 0 : 1;
+    }
+
+    /* The p99 is too noisy to gate on, it is only reported */
+    int baselineFrames = 0;
+    float baselineMean = 0, baselineP50 = 0, baselineP99 = 0;
+    FILE *file = fopen(filename, "r");
+    bool timingPassed = file != 0 &&
+                        fscanf(file, "frames %d mean %f p50 %f p99 %f", &baselineFrames, &baselineMean,
+                               &baselineP50, &baselineP99) == 4;
+    if (file)
+        fclose(file);
+
+    if (!timingPassed) {
+        fprintf(stderr, "No timing baseline %s\n", filename);
+    } else {
+        timingPassed = benchmarkMean <= baselineMean * (1 + maxSlowdown) &&
+                       benchmarkP50 <= baselineP50 * (1 + maxSlowdown);
+        printf("Timing: mean %.3f ms (baseline %.3f), p50 %.3f ms (baseline %.3f), p99 %.3f ms (baseline %.3f), "
+               "allowed slowdown %.0f%%: %s\n", benchmarkMean, baselineMean, benchmarkP50, baselineP50, benchmarkP99,
+               baselineP99, maxSlowdown * 100, timingPassed ? "pass" : "FAIL");
+    }
+
+    bool passed = imagesPassed && timingPassed;
+    file = fopen("benchmark_result.json", "w");
+    if (file) {
+        fprintf(file, "{\"pass\": %s, \"images\": %s, \"timing\": %s, \"mean_ms\": %.4f, \"p50_ms\": %.4f, "
+                      "\"p99_ms\": %.4f, \"baseline_mean_ms\": %.4f, \"baseline_p50_ms\": %.4f, "
+                      "\"max_slowdown\": %.4f}\n",
+                passed ? "true" : "false", imagesPassed ? "true" : "false", timingPassed ? "true" : "false",
+                benchmarkMean, benchmarkP50, benchmarkP99, baselineMean, baselineP50, maxSlowdown);
+        fclose(file);
+    }
+
+    printf("Regression gate: %s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+
+/******************************************************************
+*
+* WriteCpuTrace
+*
+* Writes the recorded CPU timers as Chrome trace JSON; registered
+* with atexit() so it also runs when GLUT exits
+*
+*******************************************************************/
+
+void WriteCpuTrace() {
+    int events = cpuProfilerWriteTrace(cpuTraceFile);
+    if (events >= 0)
+        printf("Wrote %d CPU timer events to %s\n", events, cpuTraceFile);
+}
+
+
 /******************************************************************
 *
 * main
@@ -552,28 +1304,101 @@ void Initialize() {
 *******************************************************************/
 
 int main(int argc, char **argv) {
-    /* Initialize GLUT; set double buffered window and RGBA color model */
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
-    glutInitWindowSize(600, 600);
-    glutInitWindowPosition(400, 400);
-    glutCreateWindow("CG Proseminar - User Interaction");
-
-    /* Initialize GL extension wrangler */
+    /* '--benchmark [frames]' renders offscreen without a window; '--golden dir' and '--record dir'
+     * check or store reference images and timings, '--max-slowdown fraction' sets the allowed regression;
+     * '--lights n' adds n point lights and '--clustered' uses clustered lighting even for few lights,
+     * '--deferred' uses deferred shading instead; '--cpu-trace file' writes the CPU timers at exit */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmarkFrames = BENCHMARK_FRAMES;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                benchmarkFrames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            goldenDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--cpu-trace") == 0 && i + 1 < argc) {
+            cpuTraceFile = argv[++i];
+        } else if (strcmp(argv[i], "--max-slowdown") == 0 && i + 1 < argc) {
+            maxSlowdown = (float) atof(argv[++i]);
+        } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            extraLights = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--clustered") == 0) {
+            clusteredLighting = true;
+        } else if (strcmp(argv[i], "--deferred") == 0) {
+            deferredShading = true;
+        } else if (strcmp(argv[i], "--shadows") == 0) {
+            shadowMapping = true;
+        } else if (strcmp(argv[i], "--no-lightmap") == 0) {
+            lightmapping = false;
+        } else if (strcmp(argv[i], "--reload-texture") == 0 && i + 1 < argc) {
+            reloadInterval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--prepass") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "on") == 0)
+                depthPrepassMode = DepthPrepassOn;
+            else if (strcmp(argv[i], "off") == 0)
+                depthPrepassMode = DepthPrepassOff;
+            else
+                depthPrepassMode = DepthPrepassAuto;
+        }
+    }
+
+    /* The gate always runs headless */
+    if ((goldenDirectory || recordDirectory) && benchmarkFrames == 0)
+        benchmarkFrames = BENCHMARK_FRAMES;
+
+    if (benchmarkFrames > 0) {
+        if (!createHeadlessContext())
+            return 1;
+    } else {
+        /* Initialize GLUT; set double buffered window and RGBA color model */
+        glutInit(&argc, argv);
+        glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
+        glutInitWindowSize(windowWidth, windowHeight);
+        glutInitWindowPosition(400, 400);
+        glutCreateWindow("CG Proseminar - User Interaction");
+    }
+
+    /* Initialize GL extension wrangler; without X, GLEW only fails to load the GLX entry points */
+    glewExperimental = GL_TRUE;
     GLenum res = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (benchmarkFrames > 0 && res == GLEW_ERROR_NO_GLX_DISPLAY)
+        res = GLEW_OK;
+#endif
     if (res != GLEW_OK) {
         fprintf(stderr, "Error: '%s'\n", glewGetErrorString(res));
         return 1;
     }
 
+    if (benchmarkFrames > 0 && !createHeadlessFramebuffer(windowWidth, windowHeight))
+        return 1;
+
+#ifdef CPU_PROFILER
+    if (cpuTraceFile)
+        atexit(WriteCpuTrace);
+#else
+    if (cpuTraceFile)
+        printf("Built with PROFILE=0, no CPU timers to write to %s\n", cpuTraceFile);
+#endif
+
     /* Setup scene and rendering parameters */
     Initialize();
 
+    if (benchmarkFrames > 0) {
+        RunBenchmark();
+        FinishShaderVariants();
+        destroyHeadlessContext();
+        return goldenDirectory || recordDirectory ? CheckRegression() : 0;
+    }
+
     /* Specify callback functions;enter GLUT event processing loop, 
      * handing control over to GLUT */
     glutIdleFunc(OnIdle);
     glutDisplayFunc(Display);
     glutKeyboardFunc(Keyboard);
+    glutCloseFunc(FinishShaderVariants);
 //    glutKeyboardUpFunc(KeyUp);
 
     glutMainLoop();
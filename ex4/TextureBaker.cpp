@@ -0,0 +1,143 @@
+/******************************************************************
+*
+* TextureBaker.cpp
+*
+* Description: Offline texture baker. Reads a BMP texture,
+* computes its mip chain with a box filter, optionally block
+* compresses every level on all cores and stores the result
+* as a KTX file that Lighting maps and uploads level by level.
+*
+* Usage: TextureBaker input.bmp output.ktx [bc1|bc3|bc7|none]
+*
+*******************************************************************/
+
+
+/* Standard includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+/* Local includes */
+#include "source/LoadTexture.h"
+#include "source/BlockCompression.hpp"
+#include "source/KtxFile.hpp"
+
+
+/******************************************************************
+*
+* HalveImage
+*
+* Averages 2x2 pixels of an RGBA8 image into one, odd sizes
+* repeat their last row or column
+*
+*******************************************************************/
+
+std::vector<unsigned char> HalveImage(const std::vector<unsigned char> &image, int width, int height) {
+    int halfWidth = std::max(1, width / 2), halfHeight = std::max(1, height / 2);
+    std::vector<unsigned char> half(halfWidth * halfHeight * 4);
+
+    for (int y = 0; y < halfHeight; y++) {
+        for (int x = 0; x < halfWidth; x++) {
+            int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int c = 0; c < 4; c++) {
+                int sum = image[(y0 * width + x0) * 4 + c] + image[(y0 * width + x1) * 4 + c] +
+                          image[(y1 * width + x0) * 4 + c] + image[(y1 * width + x1) * 4 + c];
+                half[(y * halfWidth + x) * 4 + c] = (unsigned char) ((sum + 2) / 4);
+            }
+        }
+    }
+    return half;
+}
+
+
+/******************************************************************
+*
+* main
+*
+*******************************************************************/
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s input.bmp output.ktx [bc1|bc3|bc7|none]\n", argv[0]);
+        return -1;
+    }
+
+    BlockFormat format = BlockBC1;
+    const char *formatName = argc > 3 ? argv[3] : "bc1";
+    if (strcmp(formatName, "bc1") == 0)
+        format = BlockBC1;
+    else if (strcmp(formatName, "bc3") == 0)
+        format = BlockBC3;
+    else if (strcmp(formatName, "bc7") == 0)
+        format = BlockBC7;
+    else if (strcmp(formatName, "none") == 0)
+        format = BlockNone;
+    else {
+        fprintf(stderr, "Unknown format %s, expected bc1, bc3, bc7 or none\n", formatName);
+        return -1;
+    }
+
+    TextureData texture;
+    if (!LoadTexture(argv[1], &texture))
+        return -1;
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* BMP rows are BGR and padded to 4 bytes; the row order already is the one GL expects */
+    int width = texture.width, height = texture.height;
+    int stride = (width * 3 + 3) & ~3;
+    std::vector<unsigned char> image(width * height * 4);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char *pixel = texture.data + y * stride + x * 3;
+            unsigned char *rgba = &image[(y * width + x) * 4];
+            rgba[0] = pixel[2];
+            rgba[1] = pixel[1];
+            rgba[2] = pixel[0];
+            rgba[3] = 255;
+        }
+    }
+    free(texture.data);
+
+    /* Every level down to 1x1, compressed or as is */
+    std::vector<std::vector<unsigned char> > levels;
+    int levelWidth = width, levelHeight = height, threads = 1;
+    size_t bytes = 0, uncompressedBytes = 0;
+    while (true) {
+        int levelThreads = 1;
+        if (format == BlockNone)
+            levels.push_back(image);
+        else
+            levels.push_back(compressImage(image.data(), levelWidth, levelHeight, format, levelThreads));
+        threads = std::max(threads, levelThreads);
+        bytes += levels.back().size();
+        uncompressedBytes += levelWidth * levelHeight * 4;
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        image = HalveImage(image, levelWidth, levelHeight);
+        levelWidth = std::max(1, levelWidth / 2);
+        levelHeight = std::max(1, levelHeight / 2);
+    }
+
+    /* BC1 has no alpha, the others keep it */
+    GLenum baseFormat = format == BlockBC1 ? GL_RGB : GL_RGBA;
+    bool written;
+    if (format == BlockNone)
+        written = writeKtx(argv[2], GL_UNSIGNED_BYTE, GL_RGBA, GL_RGBA8, baseFormat, width, height, levels);
+    else
+        written = writeKtx(argv[2], 0, 0, blockInternalFormat(format), baseFormat, width, height, levels);
+    if (!written)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%s: %dx%d, %d levels, %s, %zu KB (%zu KB as RGBA8) in %.1f ms on %d threads\n", argv[2], width,
+           height, (int) levels.size(), formatName, bytes / 1024, uncompressedBytes / 1024,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) * 1e-6, threads);
+    return 0;
+}
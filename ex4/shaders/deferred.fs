@@ -0,0 +1,144 @@
+#version 330
+
+//lighting pass of the deferred path; the lighting terms and SHADOWS are defined per program
+//variant, see ShaderVariants.hpp
+#define MAX_SHININESS 255.0
+
+//G-buffer, see GBuffer.hpp
+uniform sampler2D albedoSampler;  //diffuse color, specular exponent / MAX_SHININESS
+uniform sampler2D normalSampler;  //octahedral normal, specular intensity
+uniform sampler2D ambientSampler; //ambient color
+uniform sampler2D depthSampler;
+
+//scene lights binned into a view space grid, see LightClusters.hpp
+uniform samplerBuffer lightSampler;       //two texels per light: position and range, intensity
+uniform usamplerBuffer clusterSampler;    //offset and count into the index list per cluster
+uniform usamplerBuffer lightIndexSampler; //light indices
+
+//per frame data shared by all programs, see UniformBlocks.hpp; the lights array is not used here
+#define MAX_LIGHTS 2
+
+struct Light {
+	vec4 position;
+	vec4 intensity;
+};
+
+layout (std140) uniform FrameBlock {
+	mat4 InverseProjectionViewMatrix;
+	vec4 CameraPosition;
+	vec4 ClusterGrid;  //clusters in x, y, z; light count
+	vec4 ClusterDepth; //near and far plane; scale and bias from log(depth) to slice
+	vec4 ClusterTile;  //tile size in pixels
+	vec4 ShadowDepth;  //scale and bias from the distance along a cube face axis to shadow map depth
+	Light lights[MAX_LIGHTS];
+};
+
+out vec4 FragColor;
+
+#ifdef SHADOWS
+//cube depth maps of the two fixed lights (the first scene lights), see ShadowMaps.hpp
+#define SHADOW_LIGHTS 2
+
+uniform samplerCubeShadow shadowSampler0;
+uniform samplerCubeShadow shadowSampler1;
+
+//how much of the fixed light reaches p: 0 in its shadow, 1 outside, filtered in between
+float shadow(int light, vec3 p)
+{
+	vec3 d = p - vec3(lights[light].position);
+	float axis = max(abs(d.x), max(abs(d.y), abs(d.z)));
+	vec4 coords = vec4(d, ShadowDepth.x / axis + ShadowDepth.y);
+	return light == 0 ? texture(shadowSampler0, coords) : texture(shadowSampler1, coords);
+}
+#endif
+
+//light model coefficients, as in fragmentshader.fs
+const float kA = 0.1;
+const float kD = 0.5;
+const float kS = 0.2;
+
+vec3 decodeNormal(vec2 e)
+{
+	e = e * 2 - 1;
+	vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+	if (n.z < 0)
+		n.xy = (1 - abs(n.yx)) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+	return normalize(n);
+}
+
+//diffuse and specular light reflected towards the viewer, for the light direction l
+vec4 reflectedLight(vec3 l, vec3 n, vec3 v, float m, vec4 cDiffuse, vec4 cSpecular)
+{
+	vec4 reflected = vec4(0);
+#ifdef DIFFUSE
+	float iD = clamp(kD * dot(n, l), 0, 1);
+	reflected += iD * cDiffuse;
+#endif
+#ifdef SPECULAR
+	vec3 r = normalize((2*n*dot(n, l)) - l);
+	float iS = clamp(kS * pow(dot(r, v), m), 0, 1);
+	reflected += iS * cSpecular;
+#endif
+	return reflected;
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float windowDepth = texelFetch(depthSampler, pixel, 0).x;
+
+	//nothing was drawn here, keep the clear color
+	if (windowDepth == 1)
+		discard;
+
+	vec4 albedo = texelFetch(albedoSampler, pixel, 0);
+	vec4 normal = texelFetch(normalSampler, pixel, 0);
+	vec4 cAmbient = texelFetch(ambientSampler, pixel, 0);
+	vec4 cDiffuse = vec4(albedo.rgb, 1);
+	vec4 cSpecular = vec4(vec3(normal.b), 1);
+	float m = albedo.a * MAX_SHININESS;
+
+	//world position from the depth
+	vec2 screenSize = ClusterTile.xy * ClusterGrid.xy;
+	vec4 clip = vec4(gl_FragCoord.xy / screenSize * 2 - 1, windowDepth * 2 - 1, 1);
+	vec4 world = InverseProjectionViewMatrix * clip;
+	vec3 p = world.xyz / world.w;
+
+	vec3 n = decodeNormal(normal.xy);
+	vec3 v = normalize(vec3(CameraPosition) - p);
+
+	FragColor = vec4(0);
+#ifdef AMBIENT
+	FragColor += kA * cAmbient;
+#endif
+
+	//view space depth, then the exponential slice and the screen tile
+	float zNdc = 2 * windowDepth - 1;
+	float depth = 2 * ClusterDepth.x * ClusterDepth.y / (ClusterDepth.y + ClusterDepth.x - zNdc * (ClusterDepth.y - ClusterDepth.x));
+	int slice = clamp(int(log(depth) * ClusterDepth.z + ClusterDepth.w), 0, int(ClusterGrid.z) - 1);
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / ClusterTile.xy), ivec2(ClusterGrid.xy) - 1);
+	int cluster = (slice * int(ClusterGrid.y) + tile.y) * int(ClusterGrid.x) + tile.x;
+
+	uvec2 range = texelFetch(clusterSampler, cluster).xy;
+	for (uint i = 0u; i < range.y; i++) {
+		int light = int(texelFetch(lightIndexSampler, int(range.x + i)).x);
+		vec4 positionRange = texelFetch(lightSampler, light * 2);
+		vec4 intensity = texelFetch(lightSampler, light * 2 + 1);
+
+		vec3 toLight = positionRange.xyz - p;
+		float distance = length(toLight);
+
+		//smooth falloff to zero at the range, unbounded lights have range 0
+		float attenuation = 1;
+		if (positionRange.w > 0) {
+			float x = distance / positionRange.w;
+			attenuation = clamp(1 - x * x * x * x, 0, 1);
+			attenuation *= attenuation;
+		}
+#ifdef SHADOWS
+		if (light < SHADOW_LIGHTS)
+			attenuation *= shadow(light, p);
+#endif
+		FragColor += attenuation * intensity * reflectedLight(toLight / distance, n, v, m, cDiffuse, cSpecular);
+	}
+}
@@ -0,0 +1,8 @@
+#version 330
+
+//lighting pass of the deferred path: one triangle covering the screen, without vertex attributes
+void main()
+{
+	vec2 corner = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID & 2) * 2 - 1);
+	gl_Position = vec4(corner, 0, 1);
+}
@@ -0,0 +1,6 @@
+#version 330
+
+//depth pre-pass: the depth is all that is written, color writes are masked off
+void main()
+{
+}
@@ -0,0 +1,17 @@
+#version 330
+
+//depth pre-pass: only the position stream, transformed exactly like in vertexshader.vs
+invariant gl_Position;
+
+layout (std140) uniform ObjectBlock {
+	mat4 ModelViewProjectionMatrix;
+	mat4 ModelMatrix;
+	ivec4 MaterialBase;
+};
+
+layout (location = 0) in vec3 Position;
+
+void main()
+{
+	gl_Position = ModelViewProjectionMatrix*vec4(Position,1);
+}
@@ -1,62 +1,219 @@
 #version 330
 
-//texture
-uniform sampler2D textureSampler;
+//textures of the materials, one layer each (see TextureArrays.hpp)
+uniform sampler2DArray textureSampler;
 
-//colors
-uniform vec4 ambient;
-uniform vec4 diffuse;
-uniform vec4 specular;
+//colors, indexed by vMaterial (see MaterialTable.hpp)
+struct Material {
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 parameters; //x: specular exponent, y: transparency, z: texture layer (-1: none)
+};
 
-//factors for turning the lighting components on and off
-uniform float showAmbient;
-uniform float showDiffuse;
-uniform float showSpecular;
+layout (std140) uniform MaterialBlock {
+	Material materials[128];
+};
+
+//the lighting terms, the texture lookup, LIGHT_COUNT, CLUSTERED, DEFERRED, SHADOWS and LIGHTMAPPED are defined per
+//program variant, see ShaderVariants.hpp
+#define MAX_LIGHTS 2
 
 //light intensities
-uniform vec4 lI1;
-uniform vec4 lI2;
+struct Light {
+	vec4 position;
+	vec4 intensity;
+};
+
+//per frame data shared by all programs, see UniformBlocks.hpp
+layout (std140) uniform FrameBlock {
+	mat4 InverseProjectionViewMatrix;
+	vec4 CameraPosition;
+	vec4 ClusterGrid;  //clusters in x, y, z; light count
+	vec4 ClusterDepth; //near and far plane; scale and bias from log(depth) to slice
+	vec4 ClusterTile;  //tile size in pixels
+	vec4 ShadowDepth;  //scale and bias from the distance along a cube face axis to shadow map depth
+	Light lights[MAX_LIGHTS];
+};
+
+#if defined(CLUSTERED) || defined(SHADOWS)
+in vec3 vPosition;
+#endif
 
-in vec3 vLight1;
-in vec3 vLight2;
+#ifdef CLUSTERED
+//scene lights binned into a view space grid, see LightClusters.hpp
+uniform samplerBuffer lightSampler;       //two texels per light: position and range, intensity
+uniform usamplerBuffer clusterSampler;    //offset and count into the index list per cluster
+uniform usamplerBuffer lightIndexSampler; //light indices
+#endif
+
+in vec3 vLight[MAX_LIGHTS];
 in vec3 vNormal;
 in vec3 vView;
+#if defined(TEXTURED) || defined(LIGHTMAPPED)
 in vec2 UVcoords;
+#endif
+flat in int vMaterial;
+
+#ifdef DEFERRED
+//G-buffer targets, see GBuffer.hpp; lighting happens in deferred.fs
+#define MAX_SHININESS 255.0
+
+layout (location = 0) out vec4 GBufferAlbedo;
+layout (location = 1) out vec4 GBufferNormal;
+layout (location = 2) out vec4 GBufferAmbient;
 
+//octahedral normal encoding, mapped to [0, 1]
+vec2 encodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0 ? n.xy : (1 - abs(n.yx)) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+	return e * 0.5 + 0.5;
+}
+#else
 out vec4 FragColor;
+#endif
+
+#ifdef SHADOWS
+//cube depth maps of the two fixed lights (the first scene lights), see ShadowMaps.hpp
+#define SHADOW_LIGHTS 2
+
+uniform samplerCubeShadow shadowSampler0;
+uniform samplerCubeShadow shadowSampler1;
+
+//how much of the fixed light reaches p: 0 in its shadow, 1 outside, filtered in between
+float shadow(int light, vec3 p)
+{
+	vec3 d = p - vec3(lights[light].position);
+	float axis = max(abs(d.x), max(abs(d.y), abs(d.z)));
+	vec4 coords = vec4(d, ShadowDepth.x / axis + ShadowDepth.y);
+	return light == 0 ? texture(shadowSampler0, coords) : texture(shadowSampler1, coords);
+}
+#endif
+
+#ifdef LIGHTMAPPED
+//diffuse factor of the fixed light (the first scene light), baked for a white light of unit intensity,
+//see Lightmap.hpp; only the other lights are evaluated here. The direct light is in alpha and the
+//bounced light in rgb, so that the shadows of the dynamic casters only darken the direct light
+#define BAKED_LIGHT 0
+#define FIRST_DYNAMIC_LIGHT 1
+
+uniform sampler2D lightmapSampler;
+
+vec4 bakedDiffuse(vec4 cDiffuse, float directVisible)
+{
+#ifdef DIFFUSE
+	vec4 baked = texture(lightmapSampler, UVcoords);
+	return vec4(baked.a * directVisible + baked.rgb, 1) * cDiffuse;
+#else
+	return vec4(0);
+#endif
+}
+#else
+#define FIRST_DYNAMIC_LIGHT 0
+#endif
+
+//light model coefficients
+const float kD = 0.5;
+const float kS = 0.2;
+
+//diffuse and specular light reflected towards the viewer, for the light direction l
+vec4 reflectedLight(vec3 l, vec3 n, vec3 v, float m, vec4 cDiffuse, vec4 cSpecular)
+{
+	vec4 reflected = vec4(0);
+#ifdef DIFFUSE
+	float iD = clamp(kD * dot(n, l), 0, 1);
+	reflected += iD * cDiffuse;
+#endif
+#ifdef SPECULAR
+	vec3 r = normalize((2*n*dot(n, l)) - l);
+	float iS = clamp(kS * pow(dot(r, v), m), 0, 1);
+	reflected += iS * cSpecular;
+#endif
+	return reflected;
+}
 
 void main()
 {
-	//light model coefficients
 	float kA = 0.1;
-	float kD = 0.5;
-	float kS = 0.2;
-	float m = 8;
+	float m = materials[vMaterial].parameters.x;
 
 	//normalize all vectors
-	vec3 l1 = normalize(vLight1);
-	vec3 l2 = normalize(vLight2);
 	vec3 n = normalize(vNormal);
 	vec3 v = normalize(vView);
 
-	vec3 r1 = normalize((2*n*dot(n, l1)) - l1);
-	float iS1 = clamp(kS * pow(dot(r1, v), m), 0, 1);
-	vec3 r2 = normalize((2*n*dot(n, l2)) - l2);
-	float iS2 = clamp(kS * pow(dot(r2, v), m), 0, 1);
+	vec4 cAmbient = materials[vMaterial].ambient;
+	vec4 cDiffuse = materials[vMaterial].diffuse;
+	vec4 cSpecular = materials[vMaterial].specular;
 
-	float iD1 = clamp(kD * dot(n, l1), 0, 1);
-	float iD2 = clamp(kD * dot(n, l2), 0, 1);
+#ifdef TEXTURED
+	//every material of a textured mesh has a layer in the bound array, see DrawObject::setMaterial
+	cAmbient = texture(textureSampler, vec3(UVcoords, materials[vMaterial].parameters.z));
+	cDiffuse = cAmbient;
+	cSpecular = vec4(1);
+#endif
 
-	vec4 cAmbient = ambient;
-	vec4 cDiffuse = diffuse;
-	vec4 cSpecular = specular;
+#ifdef DEFERRED
+	GBufferAlbedo = vec4(cDiffuse.rgb, m / MAX_SHININESS);
+	GBufferNormal = vec4(encodeNormal(n), dot(cSpecular.rgb, vec3(1.0 / 3)), 0);
+	GBufferAmbient = cAmbient;
+#else
+	FragColor = vec4(0);
+#ifdef AMBIENT
+	FragColor += kA * cAmbient;
+#endif
 
-	if(cAmbient == vec4(0)){
-		cAmbient = texture2D(textureSampler, UVcoords);
-		cDiffuse = texture2D(textureSampler, UVcoords);
-		cSpecular = vec4(1);
-	}
+#ifdef CLUSTERED
+	//view space depth from the window depth, then the exponential slice and the screen tile
+	float zNdc = 2 * gl_FragCoord.z - 1;
+	float depth = 2 * ClusterDepth.x * ClusterDepth.y / (ClusterDepth.y + ClusterDepth.x - zNdc * (ClusterDepth.y - ClusterDepth.x));
+	int slice = clamp(int(log(depth) * ClusterDepth.z + ClusterDepth.w), 0, int(ClusterGrid.z) - 1);
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / ClusterTile.xy), ivec2(ClusterGrid.xy) - 1);
+	int cluster = (slice * int(ClusterGrid.y) + tile.y) * int(ClusterGrid.x) + tile.x;
+
+	uvec2 range = texelFetch(clusterSampler, cluster).xy;
+	for (uint i = 0u; i < range.y; i++) {
+		int light = int(texelFetch(lightIndexSampler, int(range.x + i)).x);
+		vec4 positionRange = texelFetch(lightSampler, light * 2);
+		vec4 intensity = texelFetch(lightSampler, light * 2 + 1);
+
+		vec3 toLight = positionRange.xyz - vPosition;
+		float distance = length(toLight);
 
-	FragColor = showAmbient * kA * cAmbient + lI1 * (showDiffuse * iD1 * cDiffuse + showSpecular * iS1 * cSpecular)
-		+ lI2 * (showDiffuse * iD2 * cDiffuse + showSpecular * iS2 * cSpecular);
-}
\ No newline at end of file
+		//smooth falloff to zero at the range, unbounded lights have range 0
+		float attenuation = 1;
+		if (positionRange.w > 0) {
+			float x = distance / positionRange.w;
+			attenuation = clamp(1 - x * x * x * x, 0, 1);
+			attenuation *= attenuation;
+		}
+		float visible = 1;
+#ifdef SHADOWS
+		if (light < SHADOW_LIGHTS)
+			visible = shadow(light, vPosition);
+#endif
+#ifdef LIGHTMAPPED
+		if (light == BAKED_LIGHT)
+			FragColor += attenuation * intensity * bakedDiffuse(cDiffuse, visible);
+		else
+#endif
+		FragColor += attenuation * visible * intensity * reflectedLight(toLight / distance, n, v, m, cDiffuse, cSpecular);
+	}
+#else
+#ifdef LIGHTMAPPED
+	float bakedVisible = 1;
+#ifdef SHADOWS
+	bakedVisible = shadow(BAKED_LIGHT, vPosition);
+#endif
+	FragColor += lights[BAKED_LIGHT].intensity * bakedDiffuse(cDiffuse, bakedVisible);
+#endif
+	for (int i = FIRST_DYNAMIC_LIGHT; i < LIGHT_COUNT; i++) {
+		vec4 intensity = lights[i].intensity;
+#ifdef SHADOWS
+		intensity *= shadow(i, vPosition);
+#endif
+		FragColor += intensity * reflectedLight(normalize(vLight[i]), n, v, m, cDiffuse, cSpecular);
+	}
+#endif
+#endif
+}
@@ -1,43 +1,79 @@
 #version 330
 
+//the depth pre-pass (depth.vs) has to compute bit identical positions for GL_EQUAL
+invariant gl_Position;
 
-uniform mat4 ProjectionViewMatrix;
-uniform mat4 ModelMatrix;
+//per object data, written into the frame ring each draw; the matrices also decode packed
+//positions, which are normalized to the mesh bounds (see VertexFormat.hpp)
+layout (std140) uniform ObjectBlock {
+	mat4 ModelViewProjectionMatrix;
+	mat4 ModelMatrix;
+	ivec4 MaterialBase;
+};
+
+//per frame data shared by all programs, see UniformBlocks.hpp (light 1 moves with the carousel)
+//LIGHT_COUNT is defined per program variant, see ShaderVariants.hpp
+#define MAX_LIGHTS 2
+
+struct Light {
+	vec4 position;
+	vec4 intensity;
+};
+
+layout (std140) uniform FrameBlock {
+	mat4 InverseProjectionViewMatrix;
+	vec4 CameraPosition;
+	vec4 ClusterGrid;  //clusters in x, y, z; light count
+	vec4 ClusterDepth; //near and far plane; scale and bias from log(depth) to slice
+	vec4 ClusterTile;  //tile size in pixels
+	vec4 ShadowDepth;  //scale and bias from the distance along a cube face axis to shadow map depth
+	Light lights[MAX_LIGHTS];
+};
 
 layout (location = 0) in vec3 Position;
 layout (location = 1) in vec3 Normal;
 layout (location = 2) in vec2 UV;
+layout (location = 3) in uint MaterialIndex;
 
-//light positions
-uniform vec3 lP1;
-uniform vec3 lP2;
-
-uniform vec3 cP;
-
-out vec3 vLight1;
-out vec3 vLight2;
+out vec3 vLight[MAX_LIGHTS];
 out vec3 vNormal;
 out vec3 vView;
+#if defined(TEXTURED) || defined(LIGHTMAPPED)
 out vec2 UVcoords;
+#endif
+flat out int vMaterial;
+#if defined(CLUSTERED) || defined(SHADOWS)
+out vec3 vPosition;
+#endif
 
 void main()
 {
-	gl_Position = ProjectionViewMatrix*ModelMatrix*vec4(Position,1);
+	gl_Position = ModelViewProjectionMatrix*vec4(Position,1);
 
 	//convert normal vector to world space
 //	vNormal = vec3(normalize(ModelMatrix*vec4(Normal,0)));
 	vNormal = Normal;
 
-	//convert position to world space (lP1 is already in world space)
+	//convert position to world space (light positions are already in world space)
 	vec4 p4 = (ModelMatrix*vec4(Position,1));
 	vec3 p = vec3(p4);
 
 	//calculate vector from vertex to light (in world space)
-	vLight1 = normalize(lP1 - p);
-	vLight2 = normalize(lP2 - p);
+	for (int i = 0; i < LIGHT_COUNT; i++)
+		vLight[i] = normalize(vec3(lights[i].position) - p);
+
+#if defined(CLUSTERED) || defined(SHADOWS)
+	//clustered lights and shadows are evaluated per fragment
+	vPosition = p;
+#endif
 
 	//view vector
-	vView = normalize(cP - p);
+	vView = normalize(vec3(CameraPosition) - p);
 
+#if defined(TEXTURED) || defined(LIGHTMAPPED)
 	UVcoords = UV;
+#endif
+
+	//material index into the scene wide table
+	vMaterial = MaterialBase.x + int(MaterialIndex);
 }
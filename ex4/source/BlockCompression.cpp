@@ -0,0 +1,407 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "BlockCompression.hpp"
+
+//BC7 palette weights for 4 bit indices, in 64ths
+static const int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+int blockBytes(BlockFormat format) {
+    switch (format) {
+        case BlockBC1:
+            return 8;
+        case BlockBC3:
+        case BlockBC7:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+GLenum blockInternalFormat(BlockFormat format) {
+    switch (format) {
+        case BlockBC1:
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockBC3:
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockBC7:
+            return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default:
+            return GL_RGBA8;
+    }
+}
+
+static float clampChannel(float value) {
+    return std::min(std::max(value, 0.0f), 255.0f);
+}
+
+//the 16 pixels of block (bx, by), rows and columns past the image repeat its last one
+static void gatherBlock(const unsigned char *rgba, int width, int height, int bx, int by, float block[16][4]) {
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int px = std::min(bx * 4 + x, width - 1), py = std::min(by * 4 + y, height - 1);
+            const unsigned char *pixel = rgba + (py * width + px) * 4;
+            for (int c = 0; c < 4; c++)
+                block[y * 4 + x][c] = pixel[c];
+        }
+    }
+}
+
+//extreme points of the block's first channels along their principal axis
+static void principalEndpoints(const float block[16][4], int channels, float low[4], float high[4]) {
+    float mean[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < channels; c++)
+            mean[c] += block[i][c] / 16;
+
+    float covariance[4][4] = {{0}};
+    for (int i = 0; i < 16; i++)
+        for (int a = 0; a < channels; a++)
+            for (int b = 0; b < channels; b++)
+                covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+
+    //power iteration, from the column of the channel that varies most so it never starts orthogonal
+    int widest = 0;
+    for (int c = 1; c < channels; c++)
+        if (covariance[c][c] > covariance[widest][widest])
+            widest = c;
+    float axis[4] = {0, 0, 0, 0};
+    for (int c = 0; c < channels; c++)
+        axis[c] = covariance[c][widest];
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {0, 0, 0, 0}, length = 0;
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++)
+                next[a] += covariance[a][b] * axis[b];
+            length += next[a] * next[a];
+        }
+        length = sqrtf(length);
+        if (length < 1e-6f) {
+            //a flat block, both endpoints at the mean
+            memset(axis, 0, sizeof(axis));
+            break;
+        }
+        for (int c = 0; c < channels; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float tMin = 0, tMax = 0;
+    for (int i = 0; i < 16; i++) {
+        float t = 0;
+        for (int c = 0; c < channels; c++)
+            t += (block[i][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    for (int c = 0; c < channels; c++) {
+        low[c] = clampChannel(mean[c] + axis[c] * tMin);
+        high[c] = clampChannel(mean[c] + axis[c] * tMax);
+    }
+}
+
+//endpoints minimizing the squared error of pixels at (1 - weight) * e0 + weight * e1
+static bool leastSquaresEndpoints(const float block[16][4], int channels, const float weights[16], float e0[4],
+                                  float e1[4]) {
+    float aa = 0, ab = 0, bb = 0, ax[4] = {0, 0, 0, 0}, bx[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; i++) {
+        float a = 1 - weights[i], b = weights[i];
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < channels; c++) {
+            ax[c] += a * block[i][c];
+            bx[c] += b * block[i][c];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (fabsf(determinant) < 1e-6f)
+        return false;
+    for (int c = 0; c < channels; c++) {
+        e0[c] = clampChannel((bb * ax[c] - ab * bx[c]) / determinant);
+        e1[c] = clampChannel((aa * bx[c] - ab * ax[c]) / determinant);
+    }
+    return true;
+}
+
+static int pack565(const float color[4]) {
+    int r = (int) (color[0] * 31 / 255 + 0.5f), g = (int) (color[1] * 63 / 255 + 0.5f),
+        b = (int) (color[2] * 31 / 255 + 0.5f);
+    return r << 11 | g << 5 | b;
+}
+
+//expanded the way decoders do, by repeating the high bits
+static void unpack565(int packed, float color[4]) {
+    int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+    color[0] = (float) (r << 3 | r >> 2);
+    color[1] = (float) (g << 2 | g >> 4);
+    color[2] = (float) (b << 3 | b >> 2);
+}
+
+//closest entries of the 4 color palette of c0 > c1, returns the squared error
+static float bc1Indices(const float block[16][4], int c0, int c1, unsigned int &bits, float weights[16]) {
+    static const float paletteWeights[4] = {0, 1, 1 / 3.0f, 2 / 3.0f};
+
+    float palette[4][4];
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    float error = 0;
+    bits = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0;
+        float bestDistance = 1e30f;
+        for (int k = 0; k < 4; k++) {
+            float distance = 0;
+            for (int c = 0; c < 3; c++)
+                distance += (block[i][c] - palette[k][c]) * (block[i][c] - palette[k][c]);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = k;
+            }
+        }
+        bits |= (unsigned int) best << (2 * i);
+        weights[i] = paletteWeights[best];
+        error += bestDistance;
+    }
+    return error;
+}
+
+static void encodeBC1(const float block[16][4], unsigned char *out) {
+    float low[4], high[4];
+    principalEndpoints(block, 3, low, high);
+    int c0 = pack565(high), c1 = pack565(low);
+    unsigned int bits = 0;
+
+    //equal endpoints select the 3 color mode, where index 0 is still c0
+    if (c0 != c1) {
+        if (c0 < c1)
+            std::swap(c0, c1);
+        float weights[16];
+        float error = bc1Indices(block, c0, c1, bits, weights);
+
+        //one refinement of the endpoints for the chosen indices
+        float e0[4], e1[4];
+        if (leastSquaresEndpoints(block, 3, weights, e0, e1)) {
+            int r0 = pack565(e0), r1 = pack565(e1);
+            if (r0 < r1)
+                std::swap(r0, r1);
+            unsigned int refinedBits;
+            if (r0 != r1 && bc1Indices(block, r0, r1, refinedBits, weights) < error) {
+                c0 = r0;
+                c1 = r1;
+                bits = refinedBits;
+            }
+        }
+    }
+
+    out[0] = c0 & 255;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 255;
+    out[3] = c1 >> 8;
+    for (int i = 0; i < 4; i++)
+        out[4 + i] = bits >> (8 * i) & 255;
+}
+
+//the alpha half of BC3: 8 bit endpoints a0 > a1 and 3 bit indices into 6 interpolated values
+static void encodeAlpha(const float block[16][4], unsigned char *out) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        a0 = std::max(a0, (int) block[i][3]);
+        a1 = std::min(a1, (int) block[i][3]);
+    }
+
+    unsigned long long bits = 0;
+    if (a0 > a1) {
+        float palette[8];
+        palette[0] = (float) a0;
+        palette[1] = (float) a1;
+        for (int k = 2; k < 8; k++)
+            palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7.0f;
+
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            for (int k = 1; k < 8; k++)
+                if (fabsf(block[i][3] - palette[k]) < fabsf(block[i][3] - palette[best]))
+                    best = k;
+            bits |= (unsigned long long) best << (3 * i);
+        }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = bits >> (8 * i) & 255;
+}
+
+//the 7 bit endpoint and low bit closest to an 8 bit endpoint
+static void quantizeBC7(const float endpoint[4], int quantized[4], int &pBit) {
+    float bestError = 1e30f;
+    for (int p = 0; p < 2; p++) {
+        int candidate[4];
+        float error = 0;
+        for (int c = 0; c < 4; c++) {
+            candidate[c] = std::min(std::max((int) floorf((endpoint[c] - p) / 2 + 0.5f), 0), 127);
+            float reconstructed = (float) (candidate[c] << 1 | p);
+            error += (reconstructed - endpoint[c]) * (reconstructed - endpoint[c]);
+        }
+        if (error < bestError) {
+            bestError = error;
+            pBit = p;
+            memcpy(quantized, candidate, sizeof(candidate));
+        }
+    }
+}
+
+//closest entries of the mode 6 palette, returns the squared error
+static float bc7Indices(const float block[16][4], const int q0[4], int p0, const int q1[4], int p1, int indices[16],
+                        float weights[16]) {
+    float palette[16][4];
+    for (int k = 0; k < 16; k++) {
+        for (int c = 0; c < 4; c++) {
+            int e0 = q0[c] << 1 | p0, e1 = q1[c] << 1 | p1;
+            palette[k][c] = (float) (((64 - bc7Weights[k]) * e0 + bc7Weights[k] * e1 + 32) >> 6);
+        }
+    }
+
+    float error = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0;
+        float bestDistance = 1e30f;
+        for (int k = 0; k < 16; k++) {
+            float distance = 0;
+            for (int c = 0; c < 4; c++)
+                distance += (block[i][c] - palette[k][c]) * (block[i][c] - palette[k][c]);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = k;
+            }
+        }
+        indices[i] = best;
+        weights[i] = bc7Weights[best] / 64.0f;
+        error += bestDistance;
+    }
+    return error;
+}
+
+//appends count bits of value to a little endian bit stream
+static void putBits(unsigned char *out, int &position, int value, int count) {
+    for (int b = 0; b < count; b++, position++)
+        if (value >> b & 1)
+            out[position >> 3] |= 1 << (position & 7);
+}
+
+static void encodeBC7(const float block[16][4], unsigned char *out) {
+    float low[4], high[4];
+    principalEndpoints(block, 4, low, high);
+
+    int q0[4], q1[4], p0, p1, indices[16];
+    float weights[16];
+    quantizeBC7(low, q0, p0);
+    quantizeBC7(high, q1, p1);
+    float error = bc7Indices(block, q0, p0, q1, p1, indices, weights);
+
+    //one refinement of the endpoints for the chosen indices
+    float e0[4], e1[4];
+    if (leastSquaresEndpoints(block, 4, weights, e0, e1)) {
+        int r0[4], r1[4], s0, s1, refinedIndices[16];
+        quantizeBC7(e0, r0, s0);
+        quantizeBC7(e1, r1, s1);
+        if (bc7Indices(block, r0, s0, r1, s1, refinedIndices, weights) < error) {
+            memcpy(q0, r0, sizeof(q0));
+            memcpy(q1, r1, sizeof(q1));
+            p0 = s0;
+            p1 = s1;
+            memcpy(indices, refinedIndices, sizeof(indices));
+        }
+    }
+
+    //the first index is stored without its high bit, so it must be clear: swapping the endpoints
+    //mirrors all indices
+    if (indices[0] & 8) {
+        for (int c = 0; c < 4; c++)
+            std::swap(q0[c], q1[c]);
+        std::swap(p0, p1);
+        for (int i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(out, 0, 16);
+    int position = 0;
+    putBits(out, position, 1 << 6, 7); //mode 6
+    for (int c = 0; c < 4; c++) {
+        putBits(out, position, q0[c], 7);
+        putBits(out, position, q1[c], 7);
+    }
+    putBits(out, position, p0, 1);
+    putBits(out, position, p1, 1);
+    putBits(out, position, indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        putBits(out, position, indices[i], 4);
+}
+
+//rows of blocks of one compressImage() shared by the worker threads
+struct CompressJob {
+    const unsigned char *rgba;
+    int width, height, blocksX, blocksY;
+    BlockFormat format;
+    unsigned char *output;
+    std::atomic<int> nextRow;
+};
+
+static void compressRows(CompressJob *job) {
+    int bytes = blockBytes(job->format);
+    float block[16][4];
+
+    for (int by = job->nextRow++; by < job->blocksY; by = job->nextRow++) {
+        for (int bx = 0; bx < job->blocksX; bx++) {
+            gatherBlock(job->rgba, job->width, job->height, bx, by, block);
+            unsigned char *out = job->output + (by * job->blocksX + bx) * bytes;
+            switch (job->format) {
+                case BlockBC1:
+                    encodeBC1(block, out);
+                    break;
+                case BlockBC3:
+                    encodeAlpha(block, out);
+                    encodeBC1(block, out + 8);
+                    break;
+                case BlockBC7:
+                    encodeBC7(block, out);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+std::vector<unsigned char> compressImage(const unsigned char *rgba, int width, int height, BlockFormat format,
+                                         int &threads) {
+    CompressJob job;
+    job.rgba = rgba;
+    job.width = width;
+    job.height = height;
+    job.blocksX = (width + 3) / 4;
+    job.blocksY = (height + 3) / 4;
+    job.format = format;
+    job.nextRow = 0;
+
+    std::vector<unsigned char> blocks(job.blocksX * job.blocksY * blockBytes(format));
+    job.output = blocks.data();
+
+    //rows are handed out one at a time, small mip levels use fewer threads
+    threads = std::max(1, std::min((int) std::thread::hardware_concurrency(), job.blocksY));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(std::thread(compressRows, &job));
+    for (int t = 0; t < threads; t++)
+        workers[t].join();
+    return blocks;
+}
@@ -0,0 +1,38 @@
+#ifndef bCompress
+#define bCompress
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * CPU encoders for the block compressed texture formats, used by the offline texture baker.
+ *
+ * All formats store 4x4 pixel blocks, rows of blocks from the first image row on like uncompressed
+ * texture data. BC1 (DXT1) keeps RGB in 8 bytes per block: two 565 endpoints on the principal axis of
+ * the block's colors, refined once by least squares, and 2 bit indices into the 4 color palette
+ * between them. BC3 (DXT5) adds 8 bytes of alpha with its own endpoints and 3 bit indices. BC7 is only
+ * encoded in mode 6: RGBA endpoints with 7 bits per channel and a shared low bit each, and 4 bit
+ * indices, 16 bytes per block with far less banding than BC1 on smooth gradients.
+ */
+
+enum BlockFormat {
+    BlockNone,
+    BlockBC1,
+    BlockBC3,
+    BlockBC7
+};
+
+//bytes per 4x4 block, 0 for BlockNone
+int blockBytes(BlockFormat format);
+
+//the GL internal format the blocks are uploaded as, GL_RGBA8 for BlockNone
+GLenum blockInternalFormat(BlockFormat format);
+
+//encodes an RGBA8 image into (width + 3) / 4 x (height + 3) / 4 blocks on all cores, edge pixels are
+//repeated to fill blocks at the borders; threads is set to the number of threads used
+std::vector<unsigned char> compressImage(const unsigned char *rgba, int width, int height, BlockFormat format,
+                                         int &threads);
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "BufferAllocator.hpp"
+#include "StateCache.hpp"
+
+BufferAllocator::BufferAllocator(GLsizeiptr size) {
+    capacity = size;
+    used = 0;
+    freeRanges[0] = capacity;
+
+    //GL_COPY_WRITE_BUFFER leaves the array and element array bindings alone
+    glGenBuffers(1, &buffer);
+    stateCache.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+}
+
+BufferAllocator::~BufferAllocator() {
+    stateCache.deleteBuffer(buffer);
+}
+
+BufferRange BufferAllocator::allocate(GLsizeiptr size, GLsizeiptr alignment) {
+    for (std::map<GLintptr, GLsizeiptr>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+        GLintptr start = it->first, end = it->first + it->second;
+        GLintptr offset = (start + alignment - 1) / alignment * alignment;
+        if (offset + size > end)
+            continue;
+
+        //keep the padding in front and the rest behind the allocation free
+        freeRanges.erase(it);
+        if (offset > start)
+            freeRanges[start] = offset - start;
+        if (offset + size < end)
+            freeRanges[offset + size] = end - (offset + size);
+
+        used += size;
+        BufferRange range = {offset, size};
+        return range;
+    }
+
+    fprintf(stderr, "Buffer allocator out of memory (%ld of %ld bytes used, %ld requested)\n",
+            (long) used, (long) capacity, (long) size);
+    exit(-1);
+}
+
+void BufferAllocator::free(const BufferRange &range) {
+    if (range.size == 0)
+        return;
+
+    GLintptr start = range.offset, end = range.offset + range.size;
+    used -= range.size;
+
+    //merge with the free range ending at start and the one beginning at end
+    std::map<GLintptr, GLsizeiptr>::iterator next = freeRanges.lower_bound(start);
+    if (next != freeRanges.begin()) {
+        std::map<GLintptr, GLsizeiptr>::iterator previous = next;
+        --previous;
+        if (previous->first + previous->second == start) {
+            start = previous->first;
+            freeRanges.erase(previous);
+        }
+    }
+    if (next != freeRanges.end() && next->first == end) {
+        end = next->first + next->second;
+        freeRanges.erase(next);
+    }
+
+    freeRanges[start] = end - start;
+}
+
+void BufferAllocator::upload(const BufferRange &range, const void *data) {
+    if (range.size == 0)
+        return;
+
+    stateCache.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset, range.size, data);
+}
+
+GLsizeiptr BufferAllocator::usedBytes() const {
+    return used;
+}
+
+GLsizeiptr BufferAllocator::capacityBytes() const {
+    return capacity;
+}
+
+int BufferAllocator::freeRangeCount() const {
+    return (int) freeRanges.size();
+}
@@ -0,0 +1,42 @@
+#ifndef bAllocator
+#define bAllocator
+
+#include <map>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * One large GL buffer of fixed capacity, handing out byte ranges of it.
+ * Free ranges are kept sorted by offset; allocation is first fit, freeing merges
+ * a range with its free neighbours so the buffer does not fragment into small pieces.
+ * Meshes allocated from the same buffer share one binding and are drawn with base vertex offsets.
+ */
+struct BufferRange {
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+class BufferAllocator {
+private:
+    std::map<GLintptr, GLsizeiptr> freeRanges; //offset -> size
+    GLsizeiptr capacity, used;
+
+public:
+    GLuint buffer;
+
+    explicit BufferAllocator(GLsizeiptr capacity);
+    ~BufferAllocator();
+
+    //offset is a multiple of alignment, which does not have to be a power of two (vertex strides)
+    BufferRange allocate(GLsizeiptr size, GLsizeiptr alignment);
+    void free(const BufferRange &range);
+
+    void upload(const BufferRange &range, const void *data);
+
+    GLsizeiptr usedBytes() const;
+    GLsizeiptr capacityBytes() const;
+    int freeRangeCount() const;
+};
+
+#endif
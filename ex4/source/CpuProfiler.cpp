@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+
+#include "CpuProfiler.h"
+
+struct CpuEvent {
+    const char *name;
+    long long begin, end; //nanoseconds, end < 0 while the scope is open
+};
+
+struct CpuThreadRing {
+    CpuEvent events[CPU_PROFILER_EVENTS];
+    long long written;                    //events ever started, the ring holds the last CPU_PROFILER_EVENTS
+    long long open[CPU_PROFILER_DEPTH];   //event numbers of the open scopes
+    int depth;
+    int thread;
+};
+
+//all rings, for writing the trace; rings are never freed, so threads can exit before the dump
+static std::mutex ringsMutex;
+static std::vector<CpuThreadRing *> rings;
+
+static thread_local CpuThreadRing *threadRing = 0;
+
+static long long monotonicNanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static CpuThreadRing *getThreadRing() {
+    if (threadRing)
+        return threadRing;
+
+    threadRing = new CpuThreadRing();
+    threadRing->written = 0;
+    threadRing->depth = 0;
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    threadRing->thread = (int) rings.size();
+    rings.push_back(threadRing);
+    return threadRing;
+}
+
+void cpuProfilerBegin(const char *name) {
+    CpuThreadRing *ring = getThreadRing();
+
+    //too deeply nested scopes are not recorded, but still counted so the ends match up
+    if (ring->depth < CPU_PROFILER_DEPTH) {
+        CpuEvent &event = ring->events[ring->written % CPU_PROFILER_EVENTS];
+        event.name = name;
+        event.end = -1;
+        ring->open[ring->depth] = ring->written++;
+        event.begin = monotonicNanoseconds();
+    }
+    ring->depth++;
+}
+
+void cpuProfilerEnd(void) {
+    long long now = monotonicNanoseconds();
+    CpuThreadRing *ring = getThreadRing();
+
+    if (ring->depth == 0)
+        return;
+    ring->depth--;
+    if (ring->depth >= CPU_PROFILER_DEPTH)
+        return;
+
+    //the begin event may already have been overwritten by newer events
+    long long number = ring->open[ring->depth];
+    if (ring->written - number <= CPU_PROFILER_EVENTS)
+        ring->events[number % CPU_PROFILER_EVENTS].end = now;
+}
+
+int cpuProfilerWriteTrace(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (file == 0) {
+        fprintf(stderr, "Could not write CPU trace %s\n", filename);
+        return -1;
+    }
+
+    int count = 0;
+    long long start = -1;
+    int pid = (int) getpid();
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+
+    //timestamps relative to the first recorded event keep the numbers readable
+    for (size_t r = 0; r < rings.size(); r++) {
+        CpuThreadRing *ring = rings[r];
+        long long first = ring->written > CPU_PROFILER_EVENTS ? ring->written - CPU_PROFILER_EVENTS : 0;
+        for (long long n = first; n < ring->written; n++) {
+            long long begin = ring->events[n % CPU_PROFILER_EVENTS].begin;
+            if (start < 0 || begin < start)
+                start = begin;
+        }
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (size_t r = 0; r < rings.size(); r++) {
+        CpuThreadRing *ring = rings[r];
+        long long first = ring->written > CPU_PROFILER_EVENTS ? ring->written - CPU_PROFILER_EVENTS : 0;
+
+        for (long long n = first; n < ring->written; n++) {
+            const CpuEvent &event = ring->events[n % CPU_PROFILER_EVENTS];
+            if (event.end < 0)
+                continue;
+
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    count > 0 ? ",\n" : "", event.name, pid, ring->thread, (event.begin - start) / 1000.0,
+                    (event.end - event.begin) / 1000.0);
+            count++;
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+
+    return count;
+}
@@ -0,0 +1,66 @@
+#ifndef cProfiler
+#define cProfiler
+
+/*
+ * Scoped CPU timers. Begin/end pairs are recorded with CLOCK_MONOTONIC into a ring buffer
+ * per thread (the oldest events are overwritten) and can be written as Chrome trace_event JSON,
+ * viewable in chrome://tracing or Perfetto.
+ *
+ * The macros only record anything if CPU_PROFILER is defined, otherwise they compile to nothing.
+ * Names have to be string literals (or live as long as the program), only the pointer is stored.
+ *
+ * C code uses CPU_PROFILE_BEGIN/CPU_PROFILE_END, C++ code the RAII CPU_PROFILE_SCOPE.
+ */
+
+//events kept per thread
+#define CPU_PROFILER_EVENTS 65536
+//nesting depth per thread
+#define CPU_PROFILER_DEPTH 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void cpuProfilerBegin(const char *name);
+void cpuProfilerEnd(void);
+
+//writes all recorded events of all threads; returns the number of events, -1 on error
+int cpuProfilerWriteTrace(const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef CPU_PROFILER
+#define CPU_PROFILE_BEGIN(name) cpuProfilerBegin(name)
+#define CPU_PROFILE_END() cpuProfilerEnd()
+#else
+#define CPU_PROFILE_BEGIN(name) ((void) 0)
+#define CPU_PROFILE_END() ((void) 0)
+#endif
+
+#ifdef __cplusplus
+
+class CpuProfileScope {
+public:
+    explicit CpuProfileScope(const char *name) {
+        cpuProfilerBegin(name);
+    }
+
+    ~CpuProfileScope() {
+        cpuProfilerEnd();
+    }
+};
+
+#define CPU_PROFILE_JOIN2(a, b) a##b
+#define CPU_PROFILE_JOIN(a, b) CPU_PROFILE_JOIN2(a, b)
+
+#ifdef CPU_PROFILER
+#define CPU_PROFILE_SCOPE(name) CpuProfileScope CPU_PROFILE_JOIN(cpuProfileScope, __LINE__)(name)
+#else
+#define CPU_PROFILE_SCOPE(name) ((void) 0)
+#endif
+
+#endif
+
+#endif
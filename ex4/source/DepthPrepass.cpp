@@ -0,0 +1,100 @@
+#include "DepthPrepass.hpp"
+#include "StateCache.hpp"
+
+DepthPrepass::DepthPrepass(DepthPrepassMode prepassMode, float minimumOverdraw) {
+    mode = prepassMode;
+    minOverdraw = minimumOverdraw;
+    slot = 0;
+    enabled = mode == DepthPrepassOn;
+    frames = prepassFrames = 0;
+    shadedSamples = visibleSamples = 0;
+    shadedKnown = visibleKnown = false;
+
+    glGenQueries(DEPTH_PREPASS_FRAMES, queries);
+    for (int i = 0; i < DEPTH_PREPASS_FRAMES; i++)
+        queried[i] = queriedPrepass[i] = false;
+}
+
+DepthPrepass::~DepthPrepass() {
+    glDeleteQueries(DEPTH_PREPASS_FRAMES, queries);
+}
+
+void DepthPrepass::collect() {
+    if (!queried[slot])
+        return;
+    queried[slot] = false;
+
+    GLint available = 0;
+    glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    GLuint64 samples;
+    glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &samples);
+    if (queriedPrepass[slot]) {
+        visibleSamples = samples;
+        visibleKnown = true;
+    } else {
+        shadedSamples = samples;
+        shadedKnown = true;
+    }
+}
+
+bool DepthPrepass::beginFrame() {
+    slot = (slot + 1) % DEPTH_PREPASS_FRAMES;
+    collect();
+
+    if (mode == DepthPrepassAuto) {
+        //measure both ways first, then follow the overdraw and probe the other way now and then
+        if (!shadedKnown)
+            enabled = false;
+        else if (!visibleKnown)
+            enabled = true;
+        else
+            enabled = (overdraw() >= minOverdraw) != (frames % DEPTH_PREPASS_PROBE_INTERVAL == 0);
+    }
+
+    frames++;
+    if (enabled)
+        prepassFrames++;
+    return enabled;
+}
+
+void DepthPrepass::beginShading() {
+    //the pre-pass already wrote the final depth, only fragments on it pass
+    if (enabled) {
+        stateCache.depthFunc(GL_EQUAL);
+        stateCache.depthMask(GL_FALSE);
+    }
+
+    if (mode == DepthPrepassAuto) {
+        glBeginQuery(GL_SAMPLES_PASSED, queries[slot]);
+        queried[slot] = true;
+        queriedPrepass[slot] = enabled;
+    }
+}
+
+void DepthPrepass::endShading() {
+    if (mode == DepthPrepassAuto)
+        glEndQuery(GL_SAMPLES_PASSED);
+
+    stateCache.depthFunc(GL_LESS);
+    stateCache.depthMask(GL_TRUE);
+}
+
+float DepthPrepass::overdraw() const {
+    if (!shadedKnown || !visibleKnown || visibleSamples == 0)
+        return 0;
+    return (float) shadedSamples / visibleSamples;
+}
+
+const char *DepthPrepass::modeName(DepthPrepassMode mode) {
+    switch (mode) {
+        case DepthPrepassOn:
+            return "on";
+        case DepthPrepassAuto:
+            return "auto";
+        default:
+            return "off";
+    }
+}
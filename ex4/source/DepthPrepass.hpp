@@ -0,0 +1,70 @@
+#ifndef dPrepass
+#define dPrepass
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Depth only pre-pass in front of the shading pass.
+ * The pre-pass lays down the final depth with position only draws and a fragment shader that does
+ * nothing, then the shading pass runs with GL_EQUAL and depth writes off, so every pixel is shaded
+ * once however often it is covered. That only pays off with enough overdraw to make up for
+ * drawing all geometry twice.
+ *
+ * In auto mode the shading pass is wrapped in a GL_SAMPLES_PASSED query: without the pre-pass it
+ * counts every shaded fragment, with it only the visible ones, and their ratio is the overdraw.
+ * Every DEPTH_PREPASS_PROBE_INTERVAL frames one frame is drawn the other way to keep both counts
+ * current (the image is the same either way), and the pre-pass is used while the overdraw is at
+ * least minOverdraw. Overdraw costs more the more lights every fragment shades, and least in the
+ * deferred geometry pass, which only writes the G-buffer. Like the GPU profiler, results are read back
+ * DEPTH_PREPASS_FRAMES frames later and dropped if they are still not available.
+ */
+
+#define DEPTH_PREPASS_FRAMES 4
+#define DEPTH_PREPASS_PROBE_INTERVAL 64
+//overdraw from which the pre-pass is used in auto mode, by how much a shaded fragment costs:
+//forward with the fixed lights, clustered forward, and the deferred geometry pass
+#define DEPTH_PREPASS_MIN_OVERDRAW 2.0f
+#define DEPTH_PREPASS_MIN_OVERDRAW_CLUSTERED 1.5f
+#define DEPTH_PREPASS_MIN_OVERDRAW_DEFERRED 3.0f
+
+enum DepthPrepassMode {
+    DepthPrepassOff = 0, DepthPrepassOn = 1, DepthPrepassAuto = 2
+};
+
+class DepthPrepass {
+private:
+    GLuint queries[DEPTH_PREPASS_FRAMES];
+    bool queried[DEPTH_PREPASS_FRAMES], queriedPrepass[DEPTH_PREPASS_FRAMES];
+    int slot;
+    bool enabled;
+
+    //latest sample counts of the shading pass without and with the pre-pass
+    GLuint64 shadedSamples, visibleSamples;
+    bool shadedKnown, visibleKnown;
+
+    void collect();
+
+public:
+    DepthPrepassMode mode;
+    float minOverdraw;
+    //frames drawn, and drawn with the pre-pass
+    int frames, prepassFrames;
+
+    DepthPrepass(DepthPrepassMode mode, float minOverdraw);
+    ~DepthPrepass();
+
+    //reads back old results and decides whether this frame gets the pre-pass
+    bool beginFrame();
+
+    //set the depth test up for the shading pass (and count its samples), and restore it
+    void beginShading();
+    void endShading();
+
+    //shaded fragments per visible fragment, 0 until both were measured
+    float overdraw() const;
+
+    static const char *modeName(DepthPrepassMode mode);
+};
+
+#endif
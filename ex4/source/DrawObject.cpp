@@ -1,153 +1,344 @@
+#include <map>
+
 #include "DrawObject.hpp"
+#include "Lightmap.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "StateCache.hpp"
+#include "CpuProfiler.h"
 #include "OBJParser.h"
 
 using namespace glm;
 
-DrawObject::DrawObject(const obj_scene_data *data, const vec4 material[]) {
-    v_size = data->vertex_count;
-    i_size = data->face_count;
-    n_size = data->vertex_normal_count;
-    uv_size = data->vertex_texture_count;
+BufferAllocator *DrawObject::vertexHeap = 0;
+BufferAllocator *DrawObject::indexHeap = 0;
 
-    vertices = (GLfloat *) calloc((size_t) (v_size * 3), sizeof(GLfloat));
-    normals = (GLfloat *) calloc((size_t) (n_size * 3), sizeof(GLfloat));
-    indices = (GLushort *) calloc((size_t) (i_size * 3), sizeof(GLushort));
-    uvs = (GLfloat *) calloc((size_t) (uv_size * 2), sizeof(GLfloat));
+DrawObject::DrawObject(const obj_scene_data *data, const vec4 material[], MaterialTable &materialTable,
+                       VertexFormat vertexFormat, bool lightmapped) {
+    CPU_PROFILE_SCOPE("DrawObject");
 
-    //copy vertices
-    for (int i = 0; i < v_size; i++) {
-        vertices[i * 3] = (GLfloat) (*data->vertex_list[i]).e[0];
-        vertices[i * 3 + 1] = (GLfloat) (*data->vertex_list[i]).e[1];
-        vertices[i * 3 + 2] = (GLfloat) (*data->vertex_list[i]).e[2];
-    }
+    std::map<std::pair<long long, int>, GLushort> vertexMap;
+    format = vertexFormat;
+    ownsBuffers = true;
+    Texture = 0;
+    Lightmap = 0;
+    unwrapped = false;
+    Name = "object";
 
-    for (int i = 0; i < n_size; i++) {
-        normals[i * 3] = (GLfloat) (*data->vertex_normal_list[i]).e[0];
-        normals[i * 3 + 1] = (GLfloat) (*data->vertex_normal_list[i]).e[1];
-        normals[i * 3 + 2] = (GLfloat) (*data->vertex_normal_list[i]).e[2];
+    //local material 0 is the hard coded one, OBJ material i becomes local material i + 1
+    localMaterials.resize(1);
+    textureFiles.resize(1);
+    for (int i = 0; i < data->material_count; i++) {
+        localMaterials.push_back(MaterialTable::fromObj(data->material_list[i]));
+        textureFiles.push_back(data->material_list[i]->texture_filename);
     }
 
-    //copy indices
-    for (int i = 0; i < i_size; i++) {
-        indices[i * 3] = (GLushort) (*data->face_list[i]).vertex_index[0];
-        indices[i * 3 + 1] = (GLushort) (*data->face_list[i]).vertex_index[1];
-        indices[i * 3 + 2] = (GLushort) (*data->face_list[i]).vertex_index[2];
+    //OBJ indexes positions, normals and uvs separately, GL needs one index per unique combination
+    for (int i = 0; i < data->face_count; i++) {
+        const obj_face *face = data->face_list[i];
+        GLushort corners[MAX_VERTEX_COUNT];
+        int faceMaterial = face->material_index >= 0 ? face->material_index + 1 : 0;
+
+        for (int j = 0; j < face->vertex_count; j++) {
+            int v = face->vertex_index[j], n = face->normal_index[j], t = face->texture_index[j];
+            std::pair<long long, int> key(((long long) v << 42) | ((long long) (n + 1) << 21) | (long long) (t + 1),
+                                          faceMaterial);
+
+            std::map<std::pair<long long, int>, GLushort>::iterator it = vertexMap.find(key);
+            if (it != vertexMap.end()) {
+                corners[j] = it->second;
+                continue;
+            }
+
+            if (vertexMap.size() > 0xFFFF) {
+                fprintf(stderr, "Mesh has too many vertices for 16 bit indices\n");
+                exit(-1);
+            }
+            corners[j] = (GLushort) vertexMap.size();
+            vertexMap[key] = corners[j];
+
+            for (int c = 0; c < 3; c++) {
+                vertices.push_back((GLfloat) data->vertex_list[v]->e[c]);
+                normals.push_back(n >= 0 ? (GLfloat) data->vertex_normal_list[n]->e[c] : 0);
+            }
+
+            if (data->vertex_texture_count > 0) {
+                uvs.push_back(t >= 0 ? (GLfloat) data->vertex_texture_list[t]->e[0] : 0);
+                uvs.push_back(t >= 0 ? (GLfloat) data->vertex_texture_list[t]->e[1] : 0);
+            }
+            materials.push_back((GLushort) faceMaterial);
+        }
+
+        //quads are split into a triangle fan
+        for (int j = 2; j < face->vertex_count; j++) {
+            indices.push_back(corners[0]);
+            indices.push_back(corners[j - 1]);
+            indices.push_back(corners[j]);
+        }
     }
 
-    //copy uv coordinates
-    for (int i = 0; i < uv_size; i++) {
-        uvs[i * 2] = (GLushort) (*data->vertex_texture_list[i]).e[0];
-        uvs[i * 2 + 1] = (GLushort) (*data->vertex_texture_list[i]).e[1];
+    //meshes with texture coordinates use them for the lightmap as well
+    if (lightmapped && uvs.empty()) {
+        int charts = unwrapLightmap(indices, vertices, normals, uvs, materials, LIGHTMAP_SIZE);
+        unwrapped = true;
+        printf("Unwrapped lightmap: %d charts, %d vertices\n", charts, (int) vertices.size() / 3);
     }
 
-    if (uv_size == 0)
-        memcpy(Material, material, sizeof(Material));
+    CPU_PROFILE_BEGIN("optimizeMesh");
+    optimizeMesh(indices, vertices, normals, uvs, materials);
+    CPU_PROFILE_END();
 
+    v_size = (int) vertices.size() / 3;
+    i_size = (int) indices.size() / 3;
+    uv_size = (int) uvs.size() / 2;
+
+    setMaterial(material, materialTable);
+    computeBounds();
+    buildLods();
     setupDataBuffers();
     InitialTransform = mat4(1);
     DispositionMatrix = mat4(1);
 }
 
-void DrawObject::setupDataBuffers() {
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, v_size * 3 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+DrawObject::DrawObject(const DrawObject *mesh, const vec4 material[], MaterialTable &materialTable) {
+    *this = *mesh;
+    ownsBuffers = false;
+    //lightmaps are baked for one pose
+    Lightmap = 0;
 
-    glGenBuffers(1, &nbo);
-    glBindBuffer(GL_ARRAY_BUFFER, nbo);
-    glBufferData(GL_ARRAY_BUFFER, n_size * 3 * sizeof(GLfloat), normals, GL_STATIC_DRAW);
+    setMaterial(material, materialTable);
+    InitialTransform = mat4(1);
+    DispositionMatrix = mat4(1);
+}
 
-    glGenBuffers(1, &ibo);
-    glBindBuffer(GL_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ARRAY_BUFFER, i_size * 3 * sizeof(GLushort), indices, GL_STATIC_DRAW);
+void DrawObject::setMaterial(const vec4 material[], MaterialTable &materialTable) {
+    //textured meshes get a zero material, the shader takes the colors from the texture for those
+    bool textured = uv_size > 0 && !unwrapped && materialTable.textures != 0;
+    vec4 colors[3];
+    for (int i = 0; i < 3; i++)
+        colors[i] = textured ? vec4(0) : material[i];
 
-    glGenBuffers(1, &uvbo);
-    glBindBuffer(GL_ARRAY_BUFFER, uvbo);
-    glBufferData(GL_ARRAY_BUFFER, uv_size * 2 * sizeof(GLfloat), uvs, GL_STATIC_DRAW);
-}
+    localMaterials[0] = MaterialTable::fromColors(colors);
 
-DrawObject::~DrawObject() {
-    delete vertices;
-    delete normals;
-    delete indices;
-    delete uvs;
+    //every material samples its own texture or the default one, all of them from the same array, so the
+    //textured shaders can sample without checking for a layer
+    Texture = 0;
+    for (size_t i = 0; textured && i < localMaterials.size(); i++) {
+        const std::string &file = textureFiles[i].empty() ? materialTable.textures->defaultFile : textureFiles[i];
+        TextureLayer layer = materialTable.textures->add(file);
+        if (Texture != 0 && layer.array != Texture) {
+            fprintf(stderr, "%s: %s has another format or size than the other textures of the mesh. Exiting.\n",
+                    Name, file.c_str());
+            exit(-1);
+        }
+        Texture = layer.array;
+        localMaterials[i].parameters.z = (float) layer.layer;
+    }
+    MaterialBase = materialTable.add(&localMaterials[0], (int) localMaterials.size());
+    MaterialKey = (GLuint) MaterialBase;
 }
 
-void DrawObject::draw(GLuint ShaderProgram) {
-    bindBuffers();
-
-    GLint size;
-    glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+void DrawObject::computeBounds() {
+    BoundsMin = vec3(INFINITY);
+    BoundsMax = vec3(-INFINITY);
+    for (int i = 0; i < v_size; i++) {
+        BoundsMin = min(BoundsMin, vec3(vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]));
+        BoundsMax = max(BoundsMax, vec3(vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]));
+    }
+    if (v_size == 0)
+        BoundsMin = BoundsMax = vec3(0);
 
-    bindMatrices(ShaderProgram);
-    bindVectors(ShaderProgram);
+    Center = (BoundsMin + BoundsMax) * 0.5f;
+    Radius = 0;
+    for (int i = 0; i < v_size; i++)
+        Radius = max(Radius, length(vec3(vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]) - Center));
+}
 
-    glDrawElements(GL_TRIANGLES, (GLsizei) (size / sizeof(GLushort)), GL_UNSIGNED_SHORT, 0);
+void DrawObject::worldBoundingSphere(vec3 &center, float &radius) const {
+    mat4 ModelMatrix = DispositionMatrix * InitialTransform;
+    float scale = max(length(vec3(ModelMatrix[0])), max(length(vec3(ModelMatrix[1])), length(vec3(ModelMatrix[2]))));
 
-    unbindBuffers();
+    center = vec3(ModelMatrix * vec4(Center, 1));
+    radius = Radius * scale;
 }
 
-void DrawObject::bindBuffers() const {
-    glEnableVertexAttribArray(vPosition);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glEnableVertexAttribArray(vNormal);
-    glBindBuffer(GL_ARRAY_BUFFER, nbo);
-    glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    if (uv_size > 0) {
-        glEnableVertexAttribArray(vUV);
-        glBindBuffer(GL_ARRAY_BUFFER, uvbo);
-        glVertexAttribPointer(vUV, 2, GL_FLOAT, GL_TRUE, 0, 0);
-    }
+void DrawObject::worldBoundingBox(vec3 &minimum, vec3 &maximum) const {
+    mat4 ModelMatrix = DispositionMatrix * InitialTransform;
+    vec3 center = vec3(ModelMatrix * vec4(Center, 1));
+    vec3 extent = (BoundsMax - BoundsMin) * 0.5f;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    //box around the transformed box: project the extents onto the world axes
+    vec3 worldExtent = abs(vec3(ModelMatrix[0])) * extent.x + abs(vec3(ModelMatrix[1])) * extent.y +
+                       abs(vec3(ModelMatrix[2])) * extent.z;
+    minimum = center - worldExtent;
+    maximum = center + worldExtent;
 }
 
-void DrawObject::unbindBuffers() const {
-    glDisableVertexAttribArray(vPosition);
-    glDisableVertexAttribArray(vNormal);
+void DrawObject::buildLods() {
+    CPU_PROFILE_SCOPE("buildLods");
 
-    if (uv_size > 0)
-        glDisableVertexAttribArray(vUV);
-}
+    LodLevel full = {0, (GLsizei) indices.size(), 0};
+    lods.clear();
+    lods.push_back(full);
+    lod = 0;
 
-void DrawObject::bindMatrices(GLuint ShaderProgram) const {
-    GLint ModelMatrixID = glGetUniformLocation(ShaderProgram, "ModelMatrix");
-    if (ModelMatrixID == -1) {
-        fprintf(stderr, "Could not bind uniform ModelMatrix\n");
-        exit(-1);
+    std::vector<GLushort> previous(indices), level;
+    std::vector<int> clusters;
+
+    printf("LOD chain: %d", i_size);
+    for (int l = 1; l < LOD_MAX_LEVELS; l++) {
+        int target = (int) (previous.size() / 3 * LOD_REDUCTION);
+        if (target < LOD_MIN_TRIANGLES)
+            break;
+
+        float error = simplifyMesh(previous, vertices, target, level);
+
+        //stop once seams and borders keep the simplifier from making real progress
+        if (level.size() > previous.size() * 0.9f)
+            break;
+
+        optimizeVertexCache(level, v_size, VERTEX_CACHE_SIZE, clusters);
+
+        //each level is simplified from the previous one, so the errors add up
+        LodLevel lodLevel = {(GLsizei) indices.size(), (GLsizei) level.size(), lods.back().error + error};
+        indices.insert(indices.end(), level.begin(), level.end());
+        lods.push_back(lodLevel);
+        previous.swap(level);
+
+        printf(" -> %d (error %g)", lodLevel.count / 3, lodLevel.error);
     }
-    glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, value_ptr(DispositionMatrix * InitialTransform));
+    printf(" triangles\n");
 }
 
-void DrawObject::bindVectors(GLuint ShaderProgram) {
-    GLint AmbientID = glGetUniformLocation(ShaderProgram, "ambient");
-    if (AmbientID == -1) {
-        fprintf(stderr, "Could not bind ambient vector\n");
-        exit(-1);
+void DrawObject::selectLod(vec3 cameraPosition, float pixelsPerUnit, float thresholdPixels) {
+    vec3 center;
+    float radius;
+    worldBoundingSphere(center, radius);
+
+    //object space errors scale like the bounding sphere
+    float scale = Radius > 0 ? radius / Radius : 1;
+    float distance = max(length(center - cameraPosition), 1e-3f);
+
+    lod = 0;
+    for (int l = (int) lods.size() - 1; l > 0; l--) {
+        if (lods[l].error * scale * pixelsPerUnit / distance <= thresholdPixels) {
+            lod = l;
+            break;
+        }
     }
+}
 
-    GLint DiffuseID = glGetUniformLocation(ShaderProgram, "diffuse");
-    if (DiffuseID == -1) {
-        fprintf(stderr, "Could not bind diffuse vector\n");
-        exit(-1);
+void DrawObject::setupDataBuffers() {
+    CPU_PROFILE_SCOPE("setupDataBuffers");
+
+    std::vector<GLubyte> packed;
+    VertexError error = packVertices(format, vertices, normals, uvs, materials, packed, PositionScale,
+                                     PositionOffset);
+
+    if (format == PackedFormat) {
+        printf("Packed %d vertices into %d bytes each (%d unpacked), max error: position %g, normal %g deg, uv %g\n",
+               v_size, (int) vertexStride(format), (int) vertexStride(FloatFormat),
+               error.position, error.normalDegrees, error.uv);
     }
 
-    GLint SpecularID = glGetUniformLocation(ShaderProgram, "specular");
-    if (SpecularID == -1) {
-        fprintf(stderr, "Could not bind specular vector\n");
-        exit(-1);
+    if (vertexHeap == 0) {
+        vertexHeap = new BufferAllocator(MESH_VERTEX_HEAP_SIZE);
+        indexHeap = new BufferAllocator(MESH_INDEX_HEAP_SIZE);
     }
 
-    if (uv_size == 0) {
-        glUniform4fv(AmbientID, 1, value_ptr(Material[0]));
-        glUniform4fv(DiffuseID, 1, value_ptr(Material[1]));
-        glUniform4fv(SpecularID, 1, value_ptr(Material[2]));
-    } else {
-        glUniform4fv(AmbientID, 1, value_ptr(vec4(0)));
-        glUniform4fv(DiffuseID, 1, value_ptr(vec4(0)));
-        glUniform4fv(SpecularID, 1, value_ptr(vec4(0)));
+    //vertex ranges start at a multiple of the stride, so the indices stay mesh local with a base vertex
+    GLsizeiptr stride = vertexStride(format);
+    vertexRange = vertexHeap->allocate((GLsizeiptr) packed.size(), stride);
+    indexRange = indexHeap->allocate((GLsizeiptr) (indices.size() * sizeof(GLushort)), sizeof(GLushort));
+    vertexHeap->upload(vertexRange, packed.empty() ? NULL : &packed[0]);
+    indexHeap->upload(indexRange, indices.empty() ? NULL : &indices[0]);
+
+    //the position stream for the depth pre-pass lives in the same heap, with its own base vertex
+    std::vector<GLubyte> positions;
+    packPositions(format, packed, positions);
+    GLsizeiptr positionStep = positionStride(format);
+    positionRange = vertexHeap->allocate((GLsizeiptr) positions.size(), positionStep);
+    vertexHeap->upload(positionRange, positions.empty() ? NULL : &positions[0]);
+    positionBaseVertex = (GLint) (positionRange.offset / positionStep);
+
+    vbo = vertexHeap->buffer;
+    ibo = indexHeap->buffer;
+    baseVertex = (GLint) (vertexRange.offset / stride);
+}
+
+DrawObject::~DrawObject() {
+    if (ownsBuffers) {
+        vertexHeap->free(vertexRange);
+        vertexHeap->free(positionRange);
+        indexHeap->free(indexRange);
     }
 }
+
+void DrawObject::printHeapUsage() {
+    if (vertexHeap == 0)
+        return;
+
+    printf("Mesh heaps: vertices %ld of %ld KB (%d free ranges), indices %ld of %ld KB (%d free ranges)\n",
+           (long) vertexHeap->usedBytes() / 1024, (long) vertexHeap->capacityBytes() / 1024,
+           vertexHeap->freeRangeCount(), (long) indexHeap->usedBytes() / 1024,
+           (long) indexHeap->capacityBytes() / 1024, indexHeap->freeRangeCount());
+}
+
+void DrawObject::draw(FrameRing &ring, const mat4 &projectionView) {
+    bindBuffers();
+    drawElements(ring, projectionView);
+    unbindBuffers();
+}
+
+void DrawObject::drawElements(FrameRing &ring, const mat4 &projectionView) {
+    ObjectData objectData;
+    writeObjectData(objectData, projectionView);
+    ring.upload(ObjectBinding, &objectData, sizeof(objectData));
+
+    glDrawElementsBaseVertex(GL_TRIANGLES, lods[lod].count, GL_UNSIGNED_SHORT,
+                             (void *) (indexRange.offset + lods[lod].first * sizeof(GLushort)), baseVertex);
+}
+
+void DrawObject::drawDepth(FrameRing &ring, const mat4 &projectionView, int minLod) {
+    ObjectData objectData;
+    writeObjectData(objectData, projectionView);
+    ring.upload(ObjectBinding, &objectData, sizeof(objectData));
+
+    const LodLevel &level = lods[min(max(lod, minLod), (int) lods.size() - 1)];
+    glDrawElementsBaseVertex(GL_TRIANGLES, level.count, GL_UNSIGNED_SHORT,
+                             (void *) (indexRange.offset + level.first * sizeof(GLushort)), positionBaseVertex);
+}
+
+GLuint DrawObject::vertexLayout() const {
+    return (vbo & 0x3FFF) << 2 | (GLuint) format << 1 | (uv_size > 0 ? 1 : 0);
+}
+
+void DrawObject::bindBuffers() const {
+    stateCache.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    setVertexAttributes(format, uv_size > 0);
+
+    stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+}
+
+void DrawObject::bindPositions() const {
+    stateCache.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    setPositionAttribute(format);
+
+    stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+}
+
+void DrawObject::unbindBuffers() const {
+    stateCache.disableVertexAttribArray(vPosition);
+    stateCache.disableVertexAttribArray(vNormal);
+    stateCache.disableVertexAttribArray(vMaterial);
+    stateCache.disableVertexAttribArray(vUV);
+}
+
+void DrawObject::writeObjectData(ObjectData &objectData, const mat4 &projectionView) const {
+    //position * scale + offset as a matrix (identity for float vertices)
+    mat4 decode = scale(translate(mat4(1), PositionOffset), PositionScale);
+
+    objectData.ModelMatrix = DispositionMatrix * InitialTransform * decode;
+    objectData.ModelViewProjectionMatrix = projectionView * objectData.ModelMatrix;
+    objectData.MaterialBase = ivec4(MaterialBase, 0, 0, 0);
+}
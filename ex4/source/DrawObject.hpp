@@ -1,6 +1,9 @@
 #ifndef dObject
 #define dObject
 
+#include <string>
+#include <vector>
+
 //include GL stuff
 #include <GL/glew.h>
 
@@ -9,40 +12,123 @@
 
 #include "../glm/gtc/type_ptr.hpp"
 #include "../glm/gtc/matrix_inverse.hpp"
+#include "../glm/gtc/matrix_transform.hpp"
 
 //include local stuff
 #include "OBJParser.h"
+#include "BufferAllocator.hpp"
+#include "FrameRing.hpp"
+#include "MaterialTable.hpp"
+#include "UniformBlocks.hpp"
+#include "VertexFormat.hpp"
 
 using namespace glm;
 
+//simplified levels of detail, each one aims for LOD_REDUCTION times the triangles of the previous one
+#define LOD_MAX_LEVELS 4
+#define LOD_REDUCTION 0.5f
+#define LOD_MIN_TRIANGLES 32
+
+//capacity of the vertex and index buffers shared by all meshes
+#define MESH_VERTEX_HEAP_SIZE (4 << 20)
+#define MESH_INDEX_HEAP_SIZE (2 << 20)
+
+struct LodLevel {
+    GLsizei first, count; //range in indices
+    float error;          //geometric error against the full mesh, in object space units
+};
+
 class DrawObject {
 private:
-    vec4 Material[3];
+    //hard coded material followed by the OBJ materials, added to the table as one run
+    std::vector<MaterialData> localMaterials;
+    //map_Ka of the OBJ materials by local material, empty for the default texture
+    std::vector<std::string> textureFiles;
+    bool ownsBuffers;
 
+    //all meshes live in these, created with the first mesh
+    static BufferAllocator *vertexHeap, *indexHeap;
+
+    void setMaterial(const vec4 material[], MaterialTable &materialTable);
+    void computeBounds();
+    void buildLods();
     void setupDataBuffers();
-    void bindBuffers() const;
-    void bindMatrices(GLuint ShaderProgram) const;
+    void writeObjectData(ObjectData &objectData, const mat4 &projectionView) const;
 
 public:
-    GLuint vbo, nbo, ibo, uvbo;
+    //shared heap buffers, and this mesh's ranges in them
+    GLuint vbo, ibo;
+    BufferRange vertexRange, indexRange;
+    GLint baseVertex;
+    //position only copy of the vertices for the depth pre-pass, in the vertex heap as well
+    BufferRange positionRange;
+    GLint positionBaseVertex;
 
-    GLfloat *vertices, *normals, *uvs;
-    GLushort *indices;
-    int v_size, i_size, n_size, uv_size;
+    //one entry per unique position/uv/normal combination of the OBJ faces
+    std::vector<GLfloat> vertices, normals, uvs;
+    //local material index per vertex (0: hard coded material, i + 1: OBJ material i)
+    std::vector<GLushort> materials;
+    //index lists of all levels of detail, back to back
+    std::vector<GLushort> indices;
+    int v_size, i_size, uv_size;
     mat4 InitialTransform, DispositionMatrix;
 
-    enum DataID {
-        vPosition = 0, vNormal = 2, vUV = 3
-    };
+    std::vector<LodLevel> lods;
+    int lod;
+
+    //object space bounding box, and bounding sphere around the box center
+    vec3 BoundsMin, BoundsMax, Center;
+    float Radius;
+
+    VertexFormat format;
+    vec3 PositionScale, PositionOffset;
 
-    DrawObject(const obj_scene_data *data, const vec4 Material[]);
+    //label for profiling output
+    const char *Name;
+
+    //material table index of local material 0
+    int MaterialBase;
+
+    //texture array bound while drawing (0 if untextured), the materials select their layer; and a small id
+    //shared by objects with equal materials
+    GLuint Texture;
+    GLuint MaterialKey;
+
+    //baked light (0 if none), sampled at the uvs; the uvs of unwrapped meshes are only lightmap coordinates
+    GLuint Lightmap;
+    bool unwrapped;
+
+    //with lightmapped set, meshes without uvs are unwrapped for a LIGHTMAP_SIZE lightmap (see Lightmap.hpp)
+    DrawObject(const obj_scene_data *data, const vec4 Material[], MaterialTable &materialTable,
+               VertexFormat format = PackedFormat, bool lightmapped = false);
+    //another instance of mesh, sharing its buffers
+    DrawObject(const DrawObject *mesh, const vec4 Material[], MaterialTable &materialTable);
     ~DrawObject();
 
-    void draw(GLuint ShaderProgram);
+    //bounds transformed by DispositionMatrix * InitialTransform
+    void worldBoundingSphere(vec3 &center, float &radius) const;
+    void worldBoundingBox(vec3 &minimum, vec3 &maximum) const;
+
+    //picks the coarsest level whose error projects to at most thresholdPixels
+    void selectLod(vec3 cameraPosition, float pixelsPerUnit, float thresholdPixels);
 
+    //bind + drawElements + unbind; the render queue calls the parts separately to skip redundant binds
+    void draw(FrameRing &ring, const mat4 &projectionView);
+
+    //objects with equal layouts share the vertex buffer binding and attribute setup
+    GLuint vertexLayout() const;
+
+    void bindBuffers() const;
+    //uploads the object matrices for the frame's projection * view matrix and draws the current lod
+    void drawElements(FrameRing &ring, const mat4 &projectionView);
     void unbindBuffers() const;
 
-    void bindVectors(GLuint ShaderProgram);
+    //the same draw with only the position stream bound, for the depth pre-pass and shadow maps;
+    //minLod coarsens the level for views where the detail does not show
+    void bindPositions() const;
+    void drawDepth(FrameRing &ring, const mat4 &projectionView, int minLod = 0);
+
+    static void printHeapUsage();
 };
 
 #endif
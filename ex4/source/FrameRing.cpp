@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FrameRing.hpp"
+#include "StateCache.hpp"
+
+FrameRing::FrameRing(GLsizeiptr size) {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    regionSize = (size + alignment - 1) / alignment * alignment;
+    head = 0;
+    region = 0;
+    mapped = 0;
+
+    for (int i = 0; i < FRAME_COUNT; i++)
+        fences[i] = 0;
+
+    glGenBuffers(1, &buffer);
+    stateCache.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+
+    persistent = GLEW_ARB_buffer_storage;
+    if (persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, regionSize * FRAME_COUNT, NULL, flags);
+        mapped = (GLubyte *) glMapBufferRange(GL_UNIFORM_BUFFER, 0, regionSize * FRAME_COUNT, flags);
+        if (mapped == 0) {
+            fprintf(stderr, "Could not map frame ring buffer\n");
+            exit(-1);
+        }
+    } else {
+        glBufferData(GL_UNIFORM_BUFFER, regionSize * FRAME_COUNT, NULL, GL_STREAM_DRAW);
+    }
+}
+
+FrameRing::~FrameRing() {
+    for (region = 0; region < FRAME_COUNT; region++)
+        waitForRegion();
+
+    if (persistent) {
+        stateCache.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    stateCache.deleteBuffer(buffer);
+}
+
+void FrameRing::waitForRegion() {
+    if (fences[region] == 0)
+        return;
+
+    GLenum result;
+    do {
+        result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    } while (result == GL_TIMEOUT_EXPIRED);
+
+    if (result == GL_WAIT_FAILED)
+        fprintf(stderr, "Waiting for frame ring region %d failed\n", region);
+
+    glDeleteSync(fences[region]);
+    fences[region] = 0;
+}
+
+void FrameRing::beginFrame() {
+    waitForRegion();
+    head = 0;
+}
+
+void FrameRing::endFrame() {
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region = (region + 1) % FRAME_COUNT;
+}
+
+GLintptr FrameRing::allocate(GLsizeiptr size) {
+    GLsizeiptr offset = (head + alignment - 1) / alignment * alignment;
+    if (offset + size > regionSize) {
+        fprintf(stderr, "Frame ring region overflow (%ld bytes)\n", (long) regionSize);
+        exit(-1);
+    }
+
+    head = offset + size;
+    return region * regionSize + offset;
+}
+
+void FrameRing::upload(GLuint binding, const void *data, GLsizeiptr size) {
+    GLintptr offset = allocate(size);
+
+    if (persistent) {
+        memcpy(mapped + offset, data, (size_t) size);
+    } else {
+        stateCache.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+    }
+
+    stateCache.bindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+}
@@ -0,0 +1,44 @@
+#ifndef fRing
+#define fRing
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Ring of uniform data split into FRAME_COUNT regions.
+ * The CPU fills the region of frame N while the GPU still reads the regions of the previous frames;
+ * a fence per region keeps the CPU from overwriting data that is still in use.
+ * With ARB_buffer_storage the buffer is persistently mapped and uploads are plain memcpys,
+ * otherwise they fall back to glBufferSubData into the (unused) region.
+ */
+class FrameRing {
+public:
+    static const int FRAME_COUNT = 3;
+
+private:
+    GLubyte *mapped;
+    GLsizeiptr regionSize, head;
+    GLint alignment;
+    GLsync fences[FRAME_COUNT];
+    int region;
+    bool persistent;
+
+    void waitForRegion();
+
+public:
+    GLuint buffer;
+
+    FrameRing(GLsizeiptr regionSize);
+    ~FrameRing();
+
+    void beginFrame();
+    void endFrame();
+
+    //reserves size bytes in the current region, returns the offset into buffer
+    GLintptr allocate(GLsizeiptr size);
+
+    //copies data into the current region and binds that range to an indexed uniform binding point
+    void upload(GLuint binding, const void *data, GLsizeiptr size);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "Frustum.hpp"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+Frustum extractFrustum(const mat4 &ProjectionViewMatrix) {
+    //rows of the matrix; glm is column major
+    vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = vec4(ProjectionViewMatrix[0][i], ProjectionViewMatrix[1][i],
+                      ProjectionViewMatrix[2][i], ProjectionViewMatrix[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0];
+    frustum.planes[1] = row[3] - row[0];
+    frustum.planes[2] = row[3] + row[1];
+    frustum.planes[3] = row[3] - row[1];
+    frustum.planes[4] = row[3] + row[2];
+    frustum.planes[5] = row[3] - row[2];
+
+    for (int i = 0; i < 6; i++)
+        frustum.planes[i] /= length(vec3(frustum.planes[i]));
+
+    return frustum;
+}
+
+static bool sphereVisible(const Frustum &frustum, float x, float y, float z, float radius) {
+    for (int p = 0; p < 6; p++) {
+        const vec4 &plane = frustum.planes[p];
+        if (plane.x * x + plane.y * y + plane.z * z + plane.w < -radius)
+            return false;
+    }
+    return true;
+}
+
+void cullSpheres(const Frustum &frustum, const float *x, const float *y, const float *z, const float *radius,
+                 int count, unsigned char *visible) {
+    int i = 0;
+
+#ifdef __SSE__
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i);
+        __m128 py = _mm_loadu_ps(y + i);
+        __m128 pz = _mm_loadu_ps(z + i);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+
+        //lanes stay set while the sphere is not completely behind any plane
+        __m128 inside = _mm_cmpeq_ps(px, px);
+        for (int p = 0; p < 6; p++) {
+            const vec4 &plane = frustum.planes[p];
+            __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(plane.x)), _mm_mul_ps(py, _mm_set1_ps(plane.y))),
+                    _mm_add_ps(_mm_mul_ps(pz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++)
+            visible[i + lane] = (unsigned char) ((mask >> lane) & 1);
+    }
+#endif
+
+    for (; i < count; i++)
+        visible[i] = (unsigned char) sphereVisible(frustum, x[i], y[i], z[i], radius[i]);
+}
+
+bool boxVisible(const Frustum &frustum, vec3 minimum, vec3 maximum) {
+    for (int p = 0; p < 6; p++) {
+        const vec4 &plane = frustum.planes[p];
+
+        //corner furthest along the plane normal
+        vec3 positive = vec3(plane.x >= 0 ? maximum.x : minimum.x,
+                             plane.y >= 0 ? maximum.y : minimum.y,
+                             plane.z >= 0 ? maximum.z : minimum.z);
+        if (dot(vec3(plane), positive) + plane.w < 0)
+            return false;
+    }
+    return true;
+}
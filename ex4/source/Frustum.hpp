@@ -0,0 +1,32 @@
+#ifndef vFrustum
+#define vFrustum
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+using namespace glm;
+
+/*
+ * View frustum as six normalized planes (left, right, bottom, top, near, far);
+ * a point p is inside a plane if dot(plane.xyz, p) + plane.w >= 0.
+ */
+struct Frustum {
+    vec4 planes[6];
+};
+
+//extracts the planes from a combined projection * view matrix (Gribb and Hartmann)
+Frustum extractFrustum(const mat4 &ProjectionViewMatrix);
+
+/*
+ * Tests count bounding spheres, given as separate x, y, z and radius arrays, against the frustum
+ * four at a time with SSE; visible[i] is set to 1 if sphere i may be visible and 0 otherwise.
+ */
+void cullSpheres(const Frustum &frustum, const float *x, const float *y, const float *z, const float *radius,
+                 int count, unsigned char *visible);
+
+//exact test of an axis aligned box, for objects that passed the sphere test
+bool boxVisible(const Frustum &frustum, vec3 minimum, vec3 maximum);
+
+#endif
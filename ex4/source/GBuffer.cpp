@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "GBuffer.hpp"
+#include "StateCache.hpp"
+
+static const GLenum targetFormats[GBUFFER_TARGETS] = {GL_RGBA8, GL_RGB10_A2, GL_RGBA8};
+
+GBuffer::GBuffer(int w, int h) {
+    width = w;
+    height = h;
+
+    //the lighting pass renders into whatever was bound before
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &outputFramebuffer);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenTextures(GBUFFER_TARGETS + 1, textures);
+
+    GLenum drawBuffers[GBUFFER_TARGETS];
+    for (int i = 0; i <= GBUFFER_TARGETS; i++) {
+        bool depth = i == GBUFFER_TARGETS;
+        stateCache.bindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, depth ? GL_DEPTH_COMPONENT24 : targetFormats[i], width, height, 0,
+                     depth ? GL_DEPTH_COMPONENT : GL_RGBA, depth ? GL_UNSIGNED_INT : GL_UNSIGNED_BYTE, NULL);
+
+        //the lighting pass fetches texels, no filtering or mips
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        if (depth) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[i], 0);
+        } else {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[i], 0);
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        }
+    }
+    glDrawBuffers(GBUFFER_TARGETS, drawBuffers);
+    stateCache.bindTexture(GL_TEXTURE_2D, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "G-buffer is incomplete\n");
+        exit(-1);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+}
+
+GBuffer::~GBuffer() {
+    for (int i = 0; i < GBUFFER_TARGETS + 1; i++)
+        stateCache.deleteTexture(textures[i]);
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+void GBuffer::beginGeometry() {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void GBuffer::beginLighting() {
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    for (int i = 0; i <= GBUFFER_TARGETS; i++) {
+        stateCache.activeTexture(GL_TEXTURE0 + GBUFFER_TEXTURE_UNIT + i);
+        stateCache.bindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+    stateCache.activeTexture(GL_TEXTURE0);
+}
+
+int GBuffer::bytesPerPixel() {
+    return 4 * GBUFFER_TARGETS + 4;
+}
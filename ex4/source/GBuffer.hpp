@@ -0,0 +1,45 @@
+#ifndef gTargets
+#define gTargets
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Geometry buffer of the deferred path, 16 bytes per pixel:
+ *
+ *   0  RGBA8     diffuse color, specular exponent / GBUFFER_MAX_SHININESS
+ *   1  RGB10_A2  octahedral encoded normal, specular intensity
+ *   2  RGBA8     ambient color
+ *   -  DEPTH24   depth, world positions are reconstructed from it
+ *
+ * The geometry pass writes the targets, then the lighting pass reads them on the texture units
+ * from GBUFFER_TEXTURE_UNIT on and shades every covered pixel exactly once into the framebuffer
+ * that was bound when the G-buffer was created (the window or the headless framebuffer).
+ */
+
+#define GBUFFER_TARGETS 3
+#define GBUFFER_TEXTURE_UNIT 4
+#define GBUFFER_MAX_SHININESS 255.0f
+
+class GBuffer {
+private:
+    GLuint framebuffer;
+    GLuint textures[GBUFFER_TARGETS + 1];
+    GLint outputFramebuffer;
+
+public:
+    int width, height;
+
+    GBuffer(int width, int height);
+    ~GBuffer();
+
+    //binds and clears the G-buffer for the geometry pass
+    void beginGeometry();
+
+    //binds the output framebuffer and the G-buffer textures, leaves GL_TEXTURE0 active
+    void beginLighting();
+
+    static int bytesPerPixel();
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "GpuProfiler.hpp"
+
+GpuProfiler::GpuProfiler() {
+    frame = 0;
+    perObject = false;
+    dropped = 0;
+
+    //timer queries are core since GL 3.3
+    supported = GLEW_ARB_timer_query;
+    if (!supported)
+        fprintf(stderr, "GL_ARB_timer_query not supported, GPU profiling disabled\n");
+
+    for (int i = 0; i < GPU_PROFILER_FRAMES; i++) {
+        frames[i].scopeCount = 0;
+        if (supported)
+            glGenQueries(GPU_PROFILER_SCOPES * 2, frames[i].queries);
+    }
+}
+
+GpuProfiler::~GpuProfiler() {
+    if (!supported)
+        return;
+
+    for (int i = 0; i < GPU_PROFILER_FRAMES; i++)
+        glDeleteQueries(GPU_PROFILER_SCOPES * 2, frames[i].queries);
+}
+
+int GpuProfiler::scopeId(const char *name) {
+    std::map<std::string, int>::iterator it = scopeIds.find(name);
+    if (it != scopeIds.end())
+        return it->second;
+
+    ScopeStats scopeStats;
+    scopeStats.count = 0;
+    scopeStats.next = 0;
+
+    int id = (int) names.size();
+    names.push_back(name);
+    stats.push_back(scopeStats);
+    scopeIds[name] = id;
+    return id;
+}
+
+void GpuProfiler::collect(FrameQueries &queries) {
+    for (int i = 0; i < queries.scopeCount; i++) {
+        GLint beginAvailable = 0, endAvailable = 0;
+        glGetQueryObjectiv(queries.queries[i * 2], GL_QUERY_RESULT_AVAILABLE, &beginAvailable);
+        glGetQueryObjectiv(queries.queries[i * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &endAvailable);
+        if (!beginAvailable || !endAvailable) {
+            dropped++;
+            continue;
+        }
+
+        GLuint64 beginTime, endTime;
+        glGetQueryObjectui64v(queries.queries[i * 2], GL_QUERY_RESULT, &beginTime);
+        glGetQueryObjectui64v(queries.queries[i * 2 + 1], GL_QUERY_RESULT, &endTime);
+
+        ScopeStats &scopeStats = stats[queries.scopes[i]];
+        scopeStats.samples[scopeStats.next] = (float) ((endTime - beginTime) * 1e-6);
+        scopeStats.next = (scopeStats.next + 1) % GPU_PROFILER_HISTORY;
+        scopeStats.count = std::min(scopeStats.count + 1, GPU_PROFILER_HISTORY);
+    }
+    queries.scopeCount = 0;
+}
+
+void GpuProfiler::beginFrame() {
+    if (supported)
+        collect(frames[frame]);
+}
+
+void GpuProfiler::endFrame() {
+    frame = (frame + 1) % GPU_PROFILER_FRAMES;
+}
+
+int GpuProfiler::begin(const char *name) {
+    if (!supported)
+        return -1;
+
+    FrameQueries &queries = frames[frame];
+    if (queries.scopeCount == GPU_PROFILER_SCOPES) {
+        dropped++;
+        return -1;
+    }
+
+    int scope = queries.scopeCount++;
+    queries.scopes[scope] = scopeId(name);
+    glQueryCounter(queries.queries[scope * 2], GL_TIMESTAMP);
+    return scope;
+}
+
+void GpuProfiler::end(int scope) {
+    if (scope < 0)
+        return;
+
+    glQueryCounter(frames[frame].queries[scope * 2 + 1], GL_TIMESTAMP);
+}
+
+float GpuProfiler::average(const char *name) const {
+    std::map<std::string, int>::const_iterator it = scopeIds.find(name);
+    if (it == scopeIds.end() || stats[it->second].count == 0)
+        return 0;
+
+    const ScopeStats &scopeStats = stats[it->second];
+    float sum = 0;
+    for (int i = 0; i < scopeStats.count; i++)
+        sum += scopeStats.samples[i];
+    return sum / scopeStats.count;
+}
+
+float GpuProfiler::percentile(const char *name, float p) const {
+    std::map<std::string, int>::const_iterator it = scopeIds.find(name);
+    if (it == scopeIds.end() || stats[it->second].count == 0)
+        return 0;
+
+    const ScopeStats &scopeStats = stats[it->second];
+    std::vector<float> sorted(scopeStats.samples, scopeStats.samples + scopeStats.count);
+    std::sort(sorted.begin(), sorted.end());
+
+    int index = (int) (p / 100 * (scopeStats.count - 1) + 0.5f);
+    return sorted[std::max(0, std::min(index, scopeStats.count - 1))];
+}
+
+void GpuProfiler::log() const {
+    if (!supported)
+        return;
+
+    printf("GPU times (ms, last %d samples, %d scopes dropped):\n", GPU_PROFILER_HISTORY, dropped);
+    for (size_t i = 0; i < names.size(); i++) {
+        if (stats[i].count == 0)
+            continue;
+        const char *name = names[i].c_str();
+        printf("  %-12s avg %7.3f  p50 %7.3f  p99 %7.3f\n", name, average(name), percentile(name, 50),
+               percentile(name, 99));
+    }
+}
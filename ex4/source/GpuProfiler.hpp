@@ -0,0 +1,73 @@
+#ifndef gProfiler
+#define gProfiler
+
+#include <map>
+#include <string>
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * GPU timing of named scopes with GL_TIMESTAMP queries.
+ * Every scope writes a timestamp query at begin and end, so scopes can nest.
+ * Queries are kept in a ring of GPU_PROFILER_FRAMES frames and read back when their slot comes
+ * around again; results that are still not available then are dropped instead of waiting, so
+ * the profiler never stalls the pipeline.
+ * Each scope keeps its last GPU_PROFILER_HISTORY samples for averages and percentiles.
+ */
+
+#define GPU_PROFILER_FRAMES 4
+#define GPU_PROFILER_SCOPES 64
+#define GPU_PROFILER_HISTORY 128
+
+class GpuProfiler {
+private:
+    struct ScopeStats {
+        float samples[GPU_PROFILER_HISTORY]; //milliseconds
+        int count, next;
+    };
+
+    struct FrameQueries {
+        GLuint queries[GPU_PROFILER_SCOPES * 2];
+        int scopes[GPU_PROFILER_SCOPES];
+        int scopeCount;
+    };
+
+    FrameQueries frames[GPU_PROFILER_FRAMES];
+    int frame;
+    bool supported;
+
+    std::vector<std::string> names;
+    std::vector<ScopeStats> stats;
+    std::map<std::string, int> scopeIds;
+
+    int scopeId(const char *name);
+    void collect(FrameQueries &queries);
+
+public:
+    //also time every object drawn by the render queue
+    bool perObject;
+    //scopes lost because the frame ran out of queries or the results were late
+    int dropped;
+
+    GpuProfiler();
+    ~GpuProfiler();
+
+    //beginFrame reads back the results of the frame that used this slot GPU_PROFILER_FRAMES frames ago
+    void beginFrame();
+    void endFrame();
+
+    //returns a handle for end(), -1 if the scope is not timed
+    int begin(const char *name);
+    void end(int scope);
+
+    //over the kept samples of the scope, in milliseconds; 0 for unknown scopes
+    float average(const char *name) const;
+    float percentile(const char *name, float p) const;
+
+    //prints average, p50 and p99 of all scopes
+    void log() const;
+};
+
+#endif
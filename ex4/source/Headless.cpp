@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "Headless.hpp"
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static GLuint framebuffer = 0, renderbuffers[2] = {0, 0};
+
+//prefers the surfaceless platform, which needs neither X nor a DRM device
+static EGLDisplay getDisplay() {
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay) {
+        EGLDisplay surfaceless = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (surfaceless != EGL_NO_DISPLAY)
+            return surfaceless;
+    }
+#endif
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool createHeadlessContext() {
+    display = getDisplay();
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        fprintf(stderr, "Could not initialize an EGL display\n");
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL display does not support desktop OpenGL\n");
+        return false;
+    }
+
+    //no config needed for surfaceless contexts (EGL_KHR_no_config_context)
+    EGLint attributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, HEADLESS_GL_MAJOR,
+            EGL_CONTEXT_MINOR_VERSION, HEADLESS_GL_MINOR,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+            EGL_NONE
+    };
+    context = eglCreateContext(display, (EGLConfig) 0, EGL_NO_CONTEXT, attributes);
+    if (context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Could not create an OpenGL %d.%d context (EGL error 0x%x)\n",
+                HEADLESS_GL_MAJOR, HEADLESS_GL_MINOR, eglGetError());
+        return false;
+    }
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        fprintf(stderr, "Could not make the surfaceless context current (EGL error 0x%x)\n", eglGetError());
+        return false;
+    }
+
+    printf("Headless context: EGL %d.%d\n", major, minor);
+    return true;
+}
+
+bool createHeadlessFramebuffer(int width, int height) {
+    printf("Headless renderer: %s, %s\n", glGetString(GL_VERSION), glGetString(GL_RENDERER));
+
+    //the framebuffer object replaces the window's back buffer
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(2, renderbuffers);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Headless framebuffer is incomplete\n");
+        return false;
+    }
+
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+void destroyHeadlessContext() {
+    if (context != EGL_NO_CONTEXT) {
+        glDeleteRenderbuffers(2, renderbuffers);
+        glDeleteFramebuffers(1, &framebuffer);
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        context = EGL_NO_CONTEXT;
+    }
+    if (display != EGL_NO_DISPLAY) {
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef hContext
+#define hContext
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Offscreen GL context without any window system, for benchmarks on machines without a display
+ * or GPU: EGL on the surfaceless platform (Mesa llvmpipe works), rendering into a framebuffer
+ * object with color and depth renderbuffers of the given size.
+ * The context is a compatibility profile because the renderer uses the default vertex array object.
+ */
+
+//requested context version
+#define HEADLESS_GL_MAJOR 3
+#define HEADLESS_GL_MINOR 3
+
+//both return false after printing why they failed
+//the context is created before glewInit(), the framebuffer after it
+bool createHeadlessContext();
+bool createHeadlessFramebuffer(int width, int height);
+void destroyHeadlessContext();
+
+#endif
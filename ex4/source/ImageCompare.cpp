@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <math.h>
+
+#include "ImageCompare.hpp"
+
+bool readPPM(const char *filename, int &width, int &height, std::vector<unsigned char> &pixels) {
+    FILE *file = fopen(filename, "rb");
+    if (file == 0)
+        return false;
+
+    int maximum;
+    if (fscanf(file, "P6 %d %d %d", &width, &height, &maximum) != 3 || maximum != 255 || fgetc(file) == EOF) {
+        fprintf(stderr, "%s is not an 8 bit binary PPM\n", filename);
+        fclose(file);
+        return false;
+    }
+
+    pixels.resize((size_t) width * height * 3);
+    bool complete = fread(&pixels[0], 1, pixels.size(), file) == pixels.size();
+    fclose(file);
+
+    if (!complete)
+        fprintf(stderr, "%s is truncated\n", filename);
+    return complete;
+}
+
+bool writePPM(const char *filename, int width, int height, const std::vector<unsigned char> &pixels) {
+    FILE *file = fopen(filename, "wb");
+    if (file == 0) {
+        fprintf(stderr, "Could not write %s\n", filename);
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    bool complete = fwrite(&pixels[0], 1, pixels.size(), file) == pixels.size();
+    fclose(file);
+    return complete;
+}
+
+static float linearize(unsigned char value) {
+    float c = value / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float labCurve(float t) {
+    return t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+}
+
+//sRGB to CIE L*a*b* with a D65 white point
+static void toLab(const unsigned char *rgb, float lab[3]) {
+    float r = linearize(rgb[0]), g = linearize(rgb[1]), b = linearize(rgb[2]);
+
+    float x = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f;
+    float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    float z = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f;
+
+    float fx = labCurve(x), fy = labCurve(y), fz = labCurve(z);
+    lab[0] = 116 * fy - 16;
+    lab[1] = 500 * (fx - fy);
+    lab[2] = 200 * (fy - fz);
+}
+
+ImageDifference compareImages(const std::vector<unsigned char> &a, const std::vector<unsigned char> &b,
+                              int width, int height, float deltaEThreshold) {
+    ImageDifference difference = {0, 0, 0};
+    int pixelCount = width * height, changed = 0;
+    double sum = 0;
+
+    for (int i = 0; i < pixelCount; i++) {
+        float labA[3], labB[3];
+        toLab(&a[i * 3], labA);
+        toLab(&b[i * 3], labB);
+
+        float deltaE = sqrtf((labA[0] - labB[0]) * (labA[0] - labB[0]) + (labA[1] - labB[1]) * (labA[1] - labB[1]) +
+                             (labA[2] - labB[2]) * (labA[2] - labB[2]));
+        sum += deltaE;
+        if (deltaE > difference.maxDeltaE)
+            difference.maxDeltaE = deltaE;
+        if (deltaE > deltaEThreshold)
+            changed++;
+    }
+
+    if (pixelCount > 0) {
+        difference.meanDeltaE = (float) (sum / pixelCount);
+        difference.changedFraction = (float) changed / pixelCount;
+    }
+    return difference;
+}
@@ -0,0 +1,33 @@
+#ifndef iCompare
+#define iCompare
+
+#include <vector>
+
+/*
+ * Reading, writing and comparing RGB images for the golden image regression gate.
+ * Images are binary PPM (P6, 8 bit), stored top row first like the files.
+ *
+ * The comparison is perceptual: pixels are converted from sRGB to CIE L*a*b* and compared with
+ * the CIE76 color difference, where a delta E of about 2.3 is just noticeable. Small rasterization
+ * differences between drivers only touch a few edge pixels, so the gate looks at the fraction
+ * of pixels above the threshold rather than at the maximum.
+ */
+
+//delta E below which a pixel counts as unchanged
+#define IMAGE_DELTA_E_THRESHOLD 2.3f
+//fraction of changed pixels an image may have and still pass
+#define IMAGE_CHANGED_FRACTION 0.005f
+
+struct ImageDifference {
+    float meanDeltaE, maxDeltaE;
+    float changedFraction; //pixels with a delta E above the threshold
+};
+
+bool readPPM(const char *filename, int &width, int &height, std::vector<unsigned char> &pixels);
+bool writePPM(const char *filename, int width, int height, const std::vector<unsigned char> &pixels);
+
+//both images have width * height RGB pixels
+ImageDifference compareImages(const std::vector<unsigned char> &a, const std::vector<unsigned char> &b,
+                              int width, int height, float deltaEThreshold);
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "KtxFile.hpp"
+
+static const unsigned char ktxIdentifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+//the endianness field reads as this when the file was written in the reader's byte order
+#define KTX_ENDIANNESS 0x04030201
+
+//the header after the identifier, thirteen 32 bit fields
+struct KtxHeader {
+    uint32_t endianness;
+    uint32_t glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat;
+    uint32_t pixelWidth, pixelHeight, pixelDepth;
+    uint32_t numberOfArrayElements, numberOfFaces, numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+bool writeKtx(const char *path, GLenum type, GLenum format, GLenum internalFormat, GLenum baseInternalFormat,
+              int width, int height, const std::vector<std::vector<unsigned char> > &levels) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "%s could not be created\n", path);
+        return false;
+    }
+
+    KtxHeader header;
+    header.endianness = KTX_ENDIANNESS;
+    header.glType = type;
+    header.glTypeSize = 1;
+    header.glFormat = format;
+    header.glInternalFormat = internalFormat;
+    header.glBaseInternalFormat = baseInternalFormat;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = (uint32_t) levels.size();
+    header.bytesOfKeyValueData = 0;
+
+    static const unsigned char padding[3] = {0, 0, 0};
+    bool written = fwrite(ktxIdentifier, sizeof(ktxIdentifier), 1, file) == 1 &&
+                   fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; written && i < levels.size(); i++) {
+        uint32_t imageSize = (uint32_t) levels[i].size();
+        written = fwrite(&imageSize, sizeof(imageSize), 1, file) == 1 &&
+                  fwrite(levels[i].data(), 1, imageSize, file) == imageSize;
+        //levels start at multiples of 4 bytes
+        if (written && imageSize % 4 != 0)
+            written = fwrite(padding, 1, 4 - imageSize % 4, file) == 4 - imageSize % 4;
+    }
+
+    if (fclose(file) != 0 || !written) {
+        fprintf(stderr, "%s could not be written\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool mapKtx(const char *path, KtxFile &file) {
+    file.mapping = NULL;
+    file.mappingSize = 0;
+    file.levels.clear();
+
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        printf("%s could not be opened\n", path);
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size < (off_t) (sizeof(ktxIdentifier) + sizeof(KtxHeader))) {
+        printf("%s is not a KTX file\n", path);
+        close(descriptor);
+        return false;
+    }
+
+    file.mappingSize = status.st_size;
+    file.mapping = mmap(NULL, file.mappingSize, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    //the mapping stays valid after closing the descriptor
+    close(descriptor);
+    if (file.mapping == MAP_FAILED) {
+        printf("%s could not be mapped\n", path);
+        file.mapping = NULL;
+        return false;
+    }
+
+    const unsigned char *bytes = (const unsigned char *) file.mapping;
+    KtxHeader header;
+    memcpy(&header, bytes + sizeof(ktxIdentifier), sizeof(header));
+    if (memcmp(bytes, ktxIdentifier, sizeof(ktxIdentifier)) != 0 || header.endianness != KTX_ENDIANNESS ||
+        header.pixelDepth != 0 || header.numberOfArrayElements != 0 || header.numberOfFaces != 1 ||
+        header.pixelWidth == 0 || header.pixelHeight == 0) {
+        printf("%s is not a 2D KTX texture\n", path);
+        unmapKtx(file);
+        return false;
+    }
+
+    file.type = header.glType;
+    file.format = header.glFormat;
+    file.internalFormat = header.glInternalFormat;
+    file.baseInternalFormat = header.glBaseInternalFormat;
+    file.width = header.pixelWidth;
+    file.height = header.pixelHeight;
+
+    size_t offset = sizeof(ktxIdentifier) + sizeof(KtxHeader) + header.bytesOfKeyValueData;
+    int levelCount = std::max(1, (int) header.numberOfMipmapLevels);
+    for (int i = 0; i < levelCount; i++) {
+        uint32_t imageSize;
+        if (offset + sizeof(imageSize) > file.mappingSize)
+            break;
+        memcpy(&imageSize, bytes + offset, sizeof(imageSize));
+        offset += sizeof(imageSize);
+        if (offset + imageSize > file.mappingSize)
+            break;
+
+        KtxLevel level;
+        level.width = std::max(1, file.width >> i);
+        level.height = std::max(1, file.height >> i);
+        level.size = imageSize;
+        level.data = bytes + offset;
+        file.levels.push_back(level);
+        offset += (imageSize + 3) & ~3u;
+    }
+    if ((int) file.levels.size() != levelCount) {
+        printf("%s is truncated\n", path);
+        unmapKtx(file);
+        return false;
+    }
+    return true;
+}
+
+void unmapKtx(KtxFile &file) {
+    if (file.mapping)
+        munmap(file.mapping, file.mappingSize);
+    file.mapping = NULL;
+    file.mappingSize = 0;
+    file.levels.clear();
+}
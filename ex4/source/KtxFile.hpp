@@ -0,0 +1,44 @@
+#ifndef kFile
+#define kFile
+
+#include <stddef.h>
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * KTX 1.1 container for one 2D texture and its mip chain, written by the offline texture baker.
+ *
+ * The header holds the GL upload parameters (glType and glFormat are 0 for compressed data), then
+ * every level follows as its size in bytes and the data as glTexImage2D / glCompressedTexImage2D
+ * take it. Reading maps the file into memory, so the levels are uploaded straight from the page
+ * cache without copying; keep the mapping until the upload is done.
+ */
+
+struct KtxLevel {
+    int width, height;
+    GLsizei size;
+    const unsigned char *data; //into the mapping
+};
+
+struct KtxFile {
+    GLenum type, format, internalFormat, baseInternalFormat;
+    int width, height;
+    std::vector<KtxLevel> levels;
+
+    void *mapping;
+    size_t mappingSize;
+
+    bool compressed() const { return type == 0; }
+};
+
+//levels[0] is the full size image, each following one half the size of the previous one (at least 1)
+bool writeKtx(const char *path, GLenum type, GLenum format, GLenum internalFormat, GLenum baseInternalFormat,
+              int width, int height, const std::vector<std::vector<unsigned char> > &levels);
+
+//false if the file is missing or not a 2D KTX texture of this machine's byte order
+bool mapKtx(const char *path, KtxFile &file);
+void unmapKtx(KtxFile &file);
+
+#endif
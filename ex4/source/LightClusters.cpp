@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "LightClusters.hpp"
+#include "StateCache.hpp"
+
+//formats of the texture buffers: lights, cluster ranges, light indices
+static const GLenum bufferFormats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+
+LightClusters::LightClusters(float near, float far) {
+    nearPlane = near;
+    farPlane = far;
+    lightCount = indexCount = droppedCount = 0;
+
+    clusterRanges.resize(CLUSTER_COUNT * 2);
+    clusterCounts.resize(CLUSTER_COUNT);
+
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        stateCache.bindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, bufferFormats[i], buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    stateCache.bindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+LightClusters::~LightClusters() {
+    for (int i = 0; i < 3; i++)
+        stateCache.deleteTexture(textures[i]);
+    glDeleteBuffers(3, buffers);
+}
+
+static int depthSlice(float depth, float nearPlane, float farPlane) {
+    int slice = (int) floorf(logf(depth / nearPlane) * CLUSTER_Z / logf(farPlane / nearPlane));
+    return clamp(slice, 0, CLUSTER_Z - 1);
+}
+
+static int screenTile(float ndc, int tiles) {
+    return clamp((int) floorf((ndc * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+}
+
+//depth of the near boundary of a slice
+static float sliceDepth(int slice, float nearPlane, float farPlane) {
+    return nearPlane * powf(farPlane / nearPlane, (float) slice / CLUSTER_Z);
+}
+
+bool LightClusters::sliceRange(const SceneLight &light, const vec3 &center, int &first, int &last) const {
+    first = 0;
+    last = CLUSTER_Z - 1;
+    if (light.range <= 0)
+        return true;
+
+    float depth = -center.z;
+    if (depth + light.range < nearPlane || depth - light.range > farPlane)
+        return false;
+
+    first = depthSlice(max(depth - light.range, nearPlane), nearPlane, farPlane);
+    last = depthSlice(min(depth + light.range, farPlane), nearPlane, farPlane);
+    return true;
+}
+
+bool LightClusters::tileRange(const SceneLight &light, const vec3 &center, const mat4 &projection, int slice,
+                              ivec2 &first, ivec2 &last) const {
+    first = ivec2(0);
+    last = ivec2(CLUSTER_X - 1, CLUSTER_Y - 1);
+    if (light.range <= 0)
+        return true;
+
+    //part of the sphere inside the slice: its depth range and the largest cross section
+    float depth = -center.z, r = light.range;
+    float nearDepth = max(sliceDepth(slice, nearPlane, farPlane), depth - r);
+    float farDepth = min(sliceDepth(slice + 1, nearPlane, farPlane), depth + r);
+    float closest = clamp(depth, nearDepth, farDepth);
+    float radius = sqrtf(max(r * r - (closest - depth) * (closest - depth), 0.0f));
+
+    //the screen rectangle of the box around that part is spanned by the box corners
+    vec2 ndcMin(INFINITY), ndcMax(-INFINITY);
+    for (int corner = 0; corner < 8; corner++) {
+        vec2 xy = vec2(center) + vec2(corner & 1 ? radius : -radius, corner & 2 ? radius : -radius);
+        float z = max(corner & 4 ? farDepth : nearDepth, nearPlane);
+        vec2 ndc = vec2(xy.x * projection[0][0], xy.y * projection[1][1]) / z;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    if (ndcMax.x < -1 || ndcMin.x > 1 || ndcMax.y < -1 || ndcMin.y > 1)
+        return false;
+    first = ivec2(screenTile(ndcMin.x, CLUSTER_X), screenTile(ndcMin.y, CLUSTER_Y));
+    last = ivec2(screenTile(ndcMax.x, CLUSTER_X), screenTile(ndcMax.y, CLUSTER_Y));
+    return true;
+}
+
+void LightClusters::update(const std::vector<SceneLight> &lights, const mat4 &view, const mat4 &projection) {
+    lightCount = min((int) lights.size(), MAX_SCENE_LIGHTS);
+    droppedCount = (int) lights.size() - lightCount;
+
+    lightData.resize(lightCount * 8);
+    std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+
+    //tile ranges of every light and slice, as first x, first y, last x, last y (empty: first > last)
+    std::vector<ivec4> bounds(lightCount * CLUSTER_Z, ivec4(0, 0, -1, -1));
+
+    //count the lights per cluster
+    for (int i = 0; i < lightCount; i++) {
+        const SceneLight &light = lights[i];
+        GLfloat data[8] = {light.position.x, light.position.y, light.position.z, light.range,
+                           light.intensity.x, light.intensity.y, light.intensity.z, light.intensity.w};
+        std::copy(data, data + 8, &lightData[i * 8]);
+
+        vec3 center = vec3(view * vec4(light.position, 1));
+        int firstSlice, lastSlice;
+        if (!sliceRange(light, center, firstSlice, lastSlice))
+            continue;
+
+        for (int z = firstSlice; z <= lastSlice; z++) {
+            ivec2 first, last;
+            if (!tileRange(light, center, projection, z, first, last))
+                continue;
+            bounds[i * CLUSTER_Z + z] = ivec4(first, last);
+
+            for (int y = first.y; y <= last.y; y++)
+                for (int x = first.x; x <= last.x; x++)
+                    clusterCounts[(z * CLUSTER_Y + y) * CLUSTER_X + x]++;
+        }
+    }
+
+    //each cluster gets a consecutive range of the index list
+    int offset = 0;
+    for (int c = 0; c < CLUSTER_COUNT; c++) {
+        int count = min((int) clusterCounts[c], MAX_CLUSTER_INDICES - offset);
+        droppedCount += clusterCounts[c] - count;
+        clusterRanges[c * 2] = offset;
+        clusterRanges[c * 2 + 1] = count;
+        clusterCounts[c] = 0;
+        offset += count;
+    }
+    indexCount = offset;
+    indices.resize(max(indexCount, 1));
+
+    for (int i = 0; i < lightCount; i++)
+        for (int z = 0; z < CLUSTER_Z; z++) {
+            const ivec4 &tiles = bounds[i * CLUSTER_Z + z];
+            for (int y = tiles.y; y <= tiles.w; y++)
+                for (int x = tiles.x; x <= tiles.z; x++) {
+                    int c = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+                    if (clusterCounts[c] < clusterRanges[c * 2 + 1])
+                        indices[clusterRanges[c * 2] + clusterCounts[c]++] = (GLushort) i;
+                }
+        }
+
+    //orphan the old contents, the GPU may still read them for the previous frame
+    const void *data[3] = {lightData.empty() ? 0 : &lightData[0], &clusterRanges[0], &indices[0]};
+    GLsizeiptr sizes[3] = {(GLsizeiptr) (max(lightCount, 1) * 8 * sizeof(GLfloat)),
+                           (GLsizeiptr) (clusterRanges.size() * sizeof(GLuint)),
+                           (GLsizeiptr) (indices.size() * sizeof(GLushort))};
+    for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, sizes[i], NULL, GL_STREAM_DRAW);
+        if (data[i])
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind() const {
+    GLenum units[3] = {GL_TEXTURE0 + LIGHT_TEXTURE_UNIT, GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT,
+                       GL_TEXTURE0 + LIGHT_INDEX_TEXTURE_UNIT};
+    for (int i = 0; i < 3; i++) {
+        stateCache.activeTexture(units[i]);
+        stateCache.bindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    }
+    stateCache.activeTexture(GL_TEXTURE0);
+}
+
+ClusterData LightClusters::blockData(int width, int height) const {
+    float logRatio = logf(farPlane / nearPlane);
+
+    ClusterData data;
+    data.grid = vec4(CLUSTER_X, CLUSTER_Y, CLUSTER_Z, lightCount);
+    data.depth = vec4(nearPlane, farPlane, CLUSTER_Z / logRatio, -CLUSTER_Z * logf(nearPlane) / logRatio);
+    data.tile = vec4((float) width / CLUSTER_X, (float) height / CLUSTER_Y, 0, 0);
+    return data;
+}
+
+void appendObjLights(std::vector<SceneLight> &lights, const obj_scene_data *data, const mat4 &transform) {
+    std::vector<vec3> positions;
+
+    for (int i = 0; i < data->light_point_count; i++) {
+        const double *p = data->vertex_list[data->light_point_list[i]->pos_index]->e;
+        positions.push_back(vec3(p[0], p[1], p[2]));
+    }
+    for (int i = 0; i < data->light_disc_count; i++) {
+        const double *p = data->vertex_list[data->light_disc_list[i]->pos_index]->e;
+        positions.push_back(vec3(p[0], p[1], p[2]));
+    }
+    for (int i = 0; i < data->light_quad_count; i++) {
+        vec3 center(0);
+        for (int j = 0; j < 4; j++) {
+            const double *p = data->vertex_list[data->light_quad_list[i]->vertex_index[j]]->e;
+            center += vec3(p[0], p[1], p[2]) * 0.25f;
+        }
+        positions.push_back(center);
+    }
+
+    for (size_t i = 0; i < positions.size(); i++) {
+        SceneLight light;
+        light.position = vec3(transform * vec4(positions[i], 1));
+        light.range = OBJ_LIGHT_RANGE;
+        light.intensity = OBJ_LIGHT_INTENSITY;
+        lights.push_back(light);
+    }
+}
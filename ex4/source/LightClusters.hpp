@@ -0,0 +1,91 @@
+#ifndef lClusters
+#define lClusters
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+//include local stuff
+#include "OBJParser.h"
+#include "UniformBlocks.hpp"
+
+using namespace glm;
+
+/*
+ * Clustered forward lighting: the view frustum is split into a grid of CLUSTER_X * CLUSTER_Y
+ * screen tiles and CLUSTER_Z depth slices (exponentially spaced, so clusters stay roughly cubic).
+ * Every frame the CPU bins the lights into the clusters their range touches, and each fragment
+ * only shades the lights of its cluster, so the cost per fragment depends on the local light
+ * density rather than the number of lights in the scene.
+ *
+ * Lights, the (offset, count) range per cluster and the light index lists are texture buffers
+ * on the units below; the grid parameters are part of "FrameBlock" in the shaders.
+ */
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 8
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+#define MAX_SCENE_LIGHTS 1024
+//light indices over all clusters; lights beyond that are dropped from the remaining clusters
+#define MAX_CLUSTER_INDICES (64 * 1024)
+
+//texture units of the light, cluster and index buffers (unit 0 is the material texture)
+#define LIGHT_TEXTURE_UNIT 1
+#define CLUSTER_TEXTURE_UNIT 2
+#define LIGHT_INDEX_TEXTURE_UNIT 3
+
+//defaults for lights from OBJ files, which carry no intensity or range
+#define OBJ_LIGHT_INTENSITY vec4(0.5f, 0.5f, 0.5f, 1)
+#define OBJ_LIGHT_RANGE 5.0f
+
+//a point light in world space; range 0 means the light is unbounded and lights every cluster
+struct SceneLight {
+    vec3 position;
+    float range;
+    vec4 intensity;
+};
+
+class LightClusters {
+private:
+    float nearPlane, farPlane;
+    GLuint buffers[3], textures[3];
+
+    std::vector<GLfloat> lightData;
+    std::vector<GLuint> clusterRanges, clusterCounts;
+    std::vector<GLushort> indices;
+
+    //depth slices touched by the light with the view space center; false if none
+    bool sliceRange(const SceneLight &light, const vec3 &center, int &first, int &last) const;
+
+    //screen tiles touched by the part of the light's sphere inside the slice; false if none
+    bool tileRange(const SceneLight &light, const vec3 &center, const mat4 &projection, int slice, ivec2 &first,
+                   ivec2 &last) const;
+
+public:
+    //lights and light indices binned by the last update(), and lights that did not fit
+    int lightCount, indexCount, droppedCount;
+
+    LightClusters(float nearPlane, float farPlane);
+    ~LightClusters();
+
+    //bins the lights and uploads light data, cluster ranges and index lists
+    void update(const std::vector<SceneLight> &lights, const mat4 &view, const mat4 &projection);
+
+    //binds the three texture buffers to their texture units, leaves GL_TEXTURE0 active
+    void bind() const;
+
+    ClusterData blockData(int width, int height) const;
+};
+
+//adds the lp, ld and lq records of a parsed OBJ file as point lights (discs and quads at their center)
+void appendObjLights(std::vector<SceneLight> &lights, const obj_scene_data *data, const mat4 &transform);
+
+#endif
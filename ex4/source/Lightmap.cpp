@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+
+#include "Lightmap.hpp"
+#include "StateCache.hpp"
+#include "CpuProfiler.h"
+
+#include "../glm/gtc/matrix_inverse.hpp"
+
+struct Chart {
+    vec3 u, v;            //axes of the plane the chart is projected onto
+    vec2 minimum, extent; //projected bounds, in world units
+    int x, y;             //corner in the lightmap in texels, padding included
+    std::vector<int> triangles;
+};
+
+static vec3 vertexPosition(const std::vector<GLfloat> &vertices, int i) {
+    return vec3(vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]);
+}
+
+static int chartTexels(float extent, float scale) {
+    return std::max(1, (int) ceilf(extent * scale)) + 2 * LIGHTMAP_PADDING;
+}
+
+//shelf packing, tallest charts first; false if they do not fit at this scale (texels per unit)
+static bool packCharts(std::vector<Chart> &charts, float scale, int size) {
+    std::vector<std::pair<float, int> > order(charts.size());
+    for (size_t i = 0; i < charts.size(); i++)
+        order[i] = std::make_pair(-charts[i].extent.y, (int) i);
+    std::sort(order.begin(), order.end());
+
+    int x = 0, y = 0, shelf = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        Chart &chart = charts[order[i].second];
+        int width = chartTexels(chart.extent.x, scale), height = chartTexels(chart.extent.y, scale);
+        if (x + width > size) {
+            x = 0;
+            y += shelf;
+            shelf = 0;
+        }
+        if (x + width > size || y + height > size)
+            return false;
+
+        chart.x = x;
+        chart.y = y;
+        x += width;
+        shelf = std::max(shelf, height);
+    }
+    return true;
+}
+
+int unwrapLightmap(std::vector<GLushort> &indices, std::vector<GLfloat> &vertices, std::vector<GLfloat> &normals,
+                   std::vector<GLfloat> &uvs, std::vector<GLushort> &materials, int size) {
+    CPU_PROFILE_SCOPE("unwrapLightmap");
+
+    int triangleCount = (int) indices.size() / 3;
+    int vertexCount = (int) vertices.size() / 3;
+
+    //vertices are split by normals and materials, adjacency only goes by position
+    std::map<std::pair<float, std::pair<float, float> >, int> positions;
+    std::vector<int> welded(vertexCount);
+    for (int i = 0; i < vertexCount; i++) {
+        std::pair<float, std::pair<float, float> > key(vertices[i * 3],
+                                                       std::make_pair(vertices[i * 3 + 1], vertices[i * 3 + 2]));
+        welded[i] = positions.insert(std::make_pair(key, (int) positions.size())).first->second;
+    }
+
+    std::map<std::pair<int, int>, std::vector<int> > edges;
+    std::vector<vec3> faceNormals(triangleCount);
+    for (int t = 0; t < triangleCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            int a = welded[indices[t * 3 + k]], b = welded[indices[t * 3 + (k + 1) % 3]];
+            edges[std::make_pair(std::min(a, b), std::max(a, b))].push_back(t);
+        }
+
+        vec3 a = vertexPosition(vertices, indices[t * 3]);
+        vec3 normal = cross(vertexPosition(vertices, indices[t * 3 + 1]) - a,
+                            vertexPosition(vertices, indices[t * 3 + 2]) - a);
+        faceNormals[t] = length(normal) > 0 ? normalize(normal) : vec3(0);
+    }
+
+    //grow charts over shared edges while the triangles face about the way of the first one
+    std::vector<int> chartOf(triangleCount, -1);
+    std::vector<Chart> charts;
+    for (int seed = 0; seed < triangleCount; seed++) {
+        if (chartOf[seed] >= 0)
+            continue;
+
+        Chart chart;
+        vec3 normal = faceNormals[seed];
+        std::vector<int> stack(1, seed);
+        chartOf[seed] = (int) charts.size();
+        while (!stack.empty()) {
+            int t = stack.back();
+            stack.pop_back();
+            chart.triangles.push_back(t);
+
+            for (int k = 0; k < 3; k++) {
+                int a = welded[indices[t * 3 + k]], b = welded[indices[t * 3 + (k + 1) % 3]];
+                const std::vector<int> &neighbours = edges[std::make_pair(std::min(a, b), std::max(a, b))];
+                for (size_t i = 0; i < neighbours.size(); i++) {
+                    int n = neighbours[i];
+                    if (chartOf[n] < 0 && dot(faceNormals[n], normal) >= LIGHTMAP_CHART_COS) {
+                        chartOf[n] = chartOf[seed];
+                        stack.push_back(n);
+                    }
+                }
+            }
+        }
+
+        //degenerate triangles end up alone in a chart, any plane does for them
+        if (normal == vec3(0))
+            normal = vec3(0, 0, 1);
+        vec3 helper = fabsf(normal.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+        chart.u = normalize(cross(helper, normal));
+        chart.v = cross(normal, chart.u);
+
+        vec2 minimum(INFINITY), maximum(-INFINITY);
+        for (size_t i = 0; i < chart.triangles.size(); i++) {
+            for (int k = 0; k < 3; k++) {
+                vec3 p = vertexPosition(vertices, indices[chart.triangles[i] * 3 + k]);
+                vec2 projected(dot(p, chart.u), dot(p, chart.v));
+                minimum = min(minimum, projected);
+                maximum = max(maximum, projected);
+            }
+        }
+        chart.minimum = minimum;
+        chart.extent = maximum - minimum;
+        charts.push_back(chart);
+    }
+
+    //start from the scale that would fill the lightmap, then shrink until the padded charts fit
+    float area = 0;
+    for (size_t i = 0; i < charts.size(); i++)
+        area += charts[i].extent.x * charts[i].extent.y;
+    float scale = area > 0 ? sqrtf(size * size / area) : (float) size;
+    while (!packCharts(charts, scale, size)) {
+        scale *= 0.9f;
+        if (scale < 1e-6f) {
+            fprintf(stderr, "Lightmap of %dx%d texels is too small for %d charts\n", size, size, (int) charts.size());
+            exit(-1);
+        }
+    }
+
+    //one vertex per original vertex and chart
+    std::map<std::pair<int, int>, GLushort> split;
+    std::vector<GLfloat> chartVertices, chartNormals;
+    std::vector<GLushort> chartMaterials;
+    uvs.clear();
+    for (int t = 0; t < triangleCount; t++) {
+        const Chart &chart = charts[chartOf[t]];
+        for (int k = 0; k < 3; k++) {
+            int v = indices[t * 3 + k];
+            std::pair<int, int> key(v, chartOf[t]);
+            std::map<std::pair<int, int>, GLushort>::iterator it = split.find(key);
+            if (it != split.end()) {
+                indices[t * 3 + k] = it->second;
+                continue;
+            }
+
+            if (split.size() > 0xFFFF) {
+                fprintf(stderr, "Unwrapped mesh has too many vertices for 16 bit indices\n");
+                exit(-1);
+            }
+            GLushort index = (GLushort) split.size();
+            split[key] = index;
+            indices[t * 3 + k] = index;
+
+            vec3 p = vertexPosition(vertices, v);
+            vec2 texel = vec2(chart.x, chart.y) + (float) LIGHTMAP_PADDING +
+                         (vec2(dot(p, chart.u), dot(p, chart.v)) - chart.minimum) * scale;
+            for (int c = 0; c < 3; c++) {
+                chartVertices.push_back(vertices[v * 3 + c]);
+                chartNormals.push_back(normals[v * 3 + c]);
+            }
+            uvs.push_back(texel.x / size);
+            uvs.push_back(texel.y / size);
+            chartMaterials.push_back(materials[v]);
+        }
+    }
+
+    vertices.swap(chartVertices);
+    normals.swap(chartNormals);
+    materials.swap(chartMaterials);
+    return (int) charts.size();
+}
+
+//xorshift, seeded per texel so the result does not depend on the number of threads
+static float randomFloat(unsigned int &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+//any two axes perpendicular to the normal
+static void tangentFrame(const vec3 &normal, vec3 &tangent, vec3 &bitangent) {
+    vec3 helper = fabsf(normal.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+    tangent = normalize(cross(helper, normal));
+    bitangent = cross(normal, tangent);
+}
+
+struct LightmapBaker::BakeJob {
+    int size;
+    const std::vector<vec3> *positions, *normals;
+    const std::vector<unsigned char> *covered;
+    std::vector<vec4> *light;
+    std::vector<long> rays;
+    std::atomic<int> nextRow;
+};
+
+LightmapBaker::LightmapBaker() {
+    bounceSamples = LIGHTMAP_BOUNCE_SAMPLES;
+    threads = texels = 0;
+    rays = 0;
+    milliseconds = 0;
+}
+
+void LightmapBaker::addOccluder(const DrawObject &object, const vec3 &albedo) {
+    mat4 model = object.DispositionMatrix * object.InitialTransform;
+    const LodLevel &full = object.lods[0];
+
+    for (int i = full.first; i < full.first + full.count; i += 3) {
+        Triangle triangle;
+        triangle.a = vec3(model * vec4(vertexPosition(object.vertices, object.indices[i]), 1));
+        triangle.b = vec3(model * vec4(vertexPosition(object.vertices, object.indices[i + 1]), 1));
+        triangle.c = vec3(model * vec4(vertexPosition(object.vertices, object.indices[i + 2]), 1));
+        triangle.albedo = albedo;
+        triangles.push_back(triangle);
+    }
+}
+
+void LightmapBaker::addLight(const vec3 &position) {
+    lights.push_back(position);
+}
+
+void LightmapBaker::build() {
+    CPU_PROFILE_SCOPE("build lightmap hierarchy");
+
+    nodes.clear();
+    if (triangles.empty())
+        return;
+    nodes.resize(1);
+    buildNode(0, 0, (int) triangles.size());
+}
+
+void LightmapBaker::buildNode(int node, int first, int count) {
+    vec3 boxMin(INFINITY), boxMax(-INFINITY), centerMin(INFINITY), centerMax(-INFINITY);
+    for (int i = first; i < first + count; i++) {
+        const Triangle &triangle = triangles[i];
+        boxMin = min(boxMin, min(triangle.a, min(triangle.b, triangle.c)));
+        boxMax = max(boxMax, max(triangle.a, max(triangle.b, triangle.c)));
+        vec3 center = (triangle.a + triangle.b + triangle.c) / 3.0f;
+        centerMin = min(centerMin, center);
+        centerMax = max(centerMax, center);
+    }
+    nodes[node].boxMin = boxMin;
+    nodes[node].boxMax = boxMax;
+
+    if (count <= LIGHTMAP_LEAF_SIZE) {
+        nodes[node].first = first;
+        nodes[node].count = count;
+        return;
+    }
+
+    //median split along the longest axis of the triangle centers
+    vec3 extent = centerMax - centerMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    std::vector<std::pair<float, int> > order(count);
+    for (int i = 0; i < count; i++) {
+        const Triangle &triangle = triangles[first + i];
+        order[i] = std::make_pair(triangle.a[axis] + triangle.b[axis] + triangle.c[axis], first + i);
+    }
+    int half = count / 2;
+    std::nth_element(order.begin(), order.begin() + half, order.end());
+
+    std::vector<Triangle> sorted(count);
+    for (int i = 0; i < count; i++)
+        sorted[i] = triangles[order[i].second];
+    std::copy(sorted.begin(), sorted.end(), triangles.begin() + first);
+
+    int children = (int) nodes.size();
+    nodes.resize(children + 2);
+    nodes[node].first = children;
+    nodes[node].count = 0;
+    buildNode(children, first, half);
+    buildNode(children + 1, first + half, count - half);
+}
+
+bool LightmapBaker::intersect(const vec3 &origin, const vec3 &direction, float maxDistance, float &distance,
+                              int &triangle) const {
+    distance = maxDistance;
+    triangle = -1;
+    if (nodes.empty())
+        return false;
+
+    //huge instead of infinite slopes keep the slab test free of 0 * inf
+    vec3 inverse;
+    for (int c = 0; c < 3; c++)
+        inverse[c] = fabsf(direction[c]) > 1e-9f ? 1.0f / direction[c] : (direction[c] < 0 ? -1e9f : 1e9f);
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node &node = nodes[stack[--top]];
+
+        vec3 t0 = (node.boxMin - origin) * inverse, t1 = (node.boxMax - origin) * inverse;
+        vec3 nearest = min(t0, t1), farthest = max(t0, t1);
+        float enter = std::max(std::max(nearest.x, nearest.y), std::max(nearest.z, 0.0f));
+        float leave = std::min(std::min(farthest.x, farthest.y), std::min(farthest.z, distance));
+        if (enter > leave)
+            continue;
+
+        if (node.count == 0) {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+            continue;
+        }
+
+        //Moeller-Trumbore, both sides
+        for (int i = node.first; i < node.first + node.count; i++) {
+            const Triangle &candidate = triangles[i];
+            vec3 edge1 = candidate.b - candidate.a, edge2 = candidate.c - candidate.a;
+            vec3 p = cross(direction, edge2);
+            float determinant = dot(edge1, p);
+            if (fabsf(determinant) < 1e-12f)
+                continue;
+
+            float inverseDeterminant = 1.0f / determinant;
+            vec3 s = origin - candidate.a;
+            float u = dot(s, p) * inverseDeterminant;
+            if (u < 0 || u > 1)
+                continue;
+            vec3 q = cross(s, edge1);
+            float v = dot(direction, q) * inverseDeterminant;
+            if (v < 0 || u + v > 1)
+                continue;
+
+            float t = dot(edge2, q) * inverseDeterminant;
+            if (t > 0 && t < distance) {
+                distance = t;
+                triangle = i;
+            }
+        }
+    }
+    return triangle >= 0;
+}
+
+float LightmapBaker::directLight(const vec3 &position, const vec3 &normal, long &rayCount) const {
+    float light = 0;
+    vec3 origin = position + normal * LIGHTMAP_RAY_BIAS;
+
+    for (size_t i = 0; i < lights.size(); i++) {
+        vec3 toLight = lights[i] - origin;
+        float distance = length(toLight);
+        float cosine = dot(normal, toLight) / distance;
+        if (cosine <= 0)
+            continue;
+
+        float hitDistance;
+        int hit;
+        rayCount++;
+        if (!intersect(origin, toLight / distance, distance, hitDistance, hit))
+            light += std::min(LIGHTMAP_DIFFUSE * cosine, 1.0f);
+    }
+    return light;
+}
+
+vec4 LightmapBaker::bakeTexel(const vec3 &position, const vec3 &normal, unsigned int seed, long &rayCount) const {
+    float light = directLight(position, normal, rayCount);
+    if (bounceSamples == 0)
+        return vec4(vec3(0), light);
+
+    vec3 tangent, bitangent;
+    tangentFrame(normal, tangent, bitangent);
+    vec3 origin = position + normal * LIGHTMAP_RAY_BIAS;
+
+    //cosine distributed directions; the hit surfaces reflect their direct light in their color, the
+    //cosine weighting cancels the 1 / pi of diffuse reflection and the receiver reflects kD of it
+    vec3 bounced(0);
+    for (int s = 0; s < bounceSamples; s++) {
+        float angle = 2 * (float) M_PI * randomFloat(seed), radius2 = randomFloat(seed);
+        float radius = sqrtf(radius2);
+        vec3 direction = tangent * (radius * cosf(angle)) + bitangent * (radius * sinf(angle)) +
+                         normal * sqrtf(1 - radius2);
+
+        float distance;
+        int hit;
+        rayCount++;
+        if (!intersect(origin, direction, INFINITY, distance, hit))
+            continue;
+
+        const Triangle &triangle = triangles[hit];
+        vec3 hitNormal = normalize(cross(triangle.b - triangle.a, triangle.c - triangle.a));
+        if (dot(hitNormal, direction) > 0)
+            hitNormal = -hitNormal;
+        bounced += triangle.albedo * directLight(origin + direction * distance, hitNormal, rayCount);
+    }
+    return vec4(bounced * (LIGHTMAP_DIFFUSE / bounceSamples), light);
+}
+
+void LightmapBaker::bakeRows(BakeJob *job, int thread) const {
+    long rayCount = 0;
+    int size = job->size;
+
+    for (int y = job->nextRow++; y < size; y = job->nextRow++) {
+        for (int x = 0; x < size; x++) {
+            int texel = y * size + x;
+            if ((*job->covered)[texel])
+                (*job->light)[texel] = bakeTexel((*job->positions)[texel], (*job->normals)[texel],
+                                                 (unsigned int) texel * 2654435761u | 1, rayCount);
+        }
+    }
+    job->rays[thread] = rayCount;
+}
+
+static float cross2(const vec2 &a, const vec2 &b) {
+    return a.x * b.y - a.y * b.x;
+}
+
+GLuint LightmapBaker::bake(const DrawObject &object, int size) {
+    CPU_PROFILE_SCOPE("bake lightmap");
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    mat4 model = object.DispositionMatrix * object.InitialTransform;
+    mat3 normalMatrix = inverseTranspose(mat3(model));
+
+    //world position and normal at every texel center covered by the mesh
+    std::vector<vec3> positions(size * size), normals(size * size);
+    std::vector<vec4> light(size * size, vec4(0));
+    std::vector<unsigned char> covered(size * size, 0);
+    const LodLevel &full = object.lods[0];
+    for (int i = full.first; i < full.first + full.count; i += 3) {
+        int v[3];
+        vec2 uv[3];
+        for (int k = 0; k < 3; k++) {
+            v[k] = object.indices[i + k];
+            uv[k] = vec2(object.uvs[v[k] * 2], object.uvs[v[k] * 2 + 1]) * (float) size;
+        }
+        float area = cross2(uv[1] - uv[0], uv[2] - uv[0]);
+        if (fabsf(area) < 1e-12f)
+            continue;
+
+        vec2 low = min(uv[0], min(uv[1], uv[2])), high = max(uv[0], max(uv[1], uv[2]));
+        int xMin = std::max(0, (int) floorf(low.x)), xMax = std::min(size - 1, (int) ceilf(high.x));
+        int yMin = std::max(0, (int) floorf(low.y)), yMax = std::min(size - 1, (int) ceilf(high.y));
+        for (int y = yMin; y <= yMax; y++) {
+            for (int x = xMin; x <= xMax; x++) {
+                vec2 center(x + 0.5f, y + 0.5f);
+                float w0 = cross2(uv[1] - center, uv[2] - center) / area;
+                float w1 = cross2(uv[2] - center, uv[0] - center) / area;
+                float w2 = 1 - w0 - w1;
+                if (w0 < 0 || w1 < 0 || w2 < 0)
+                    continue;
+
+                vec3 p = w0 * vertexPosition(object.vertices, v[0]) + w1 * vertexPosition(object.vertices, v[1]) +
+                         w2 * vertexPosition(object.vertices, v[2]);
+                vec3 n = w0 * vertexPosition(object.normals, v[0]) + w1 * vertexPosition(object.normals, v[1]) +
+                         w2 * vertexPosition(object.normals, v[2]);
+                int texel = y * size + x;
+                positions[texel] = vec3(model * vec4(p, 1));
+                normals[texel] = normalize(normalMatrix * n);
+                covered[texel] = 1;
+            }
+        }
+    }
+
+    texels = 0;
+    for (int i = 0; i < size * size; i++)
+        texels += covered[i];
+
+    //rows are handed out one at a time, texels cost very different amounts of rays
+    threads = std::max(1, (int) std::thread::hardware_concurrency());
+    BakeJob job;
+    job.size = size;
+    job.positions = &positions;
+    job.normals = &normals;
+    job.covered = &covered;
+    job.light = &light;
+    job.rays.assign(threads, 0);
+    job.nextRow = 0;
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(std::thread(&LightmapBaker::bakeRows, this, &job, t));
+    rays = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+        rays += job.rays[t];
+    }
+
+    //grow the charts into their padding, so filtering at chart borders only mixes baked texels
+    for (int pass = 0; pass < LIGHTMAP_PADDING; pass++) {
+        std::vector<unsigned char> grown(covered);
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                if (covered[y * size + x])
+                    continue;
+
+                vec4 sum(0);
+                int count = 0;
+                for (int dy = std::max(y - 1, 0); dy <= std::min(y + 1, size - 1); dy++) {
+                    for (int dx = std::max(x - 1, 0); dx <= std::min(x + 1, size - 1); dx++) {
+                        if (covered[dy * size + dx]) {
+                            sum += light[dy * size + dx];
+                            count++;
+                        }
+                    }
+                }
+                if (count > 0) {
+                    light[y * size + x] = sum / (float) count;
+                    grown[y * size + x] = 1;
+                }
+            }
+        }
+        covered.swap(grown);
+    }
+
+    //8 bits are plenty for the smooth gradients, and filter a lot faster than half floats in software
+    std::vector<GLubyte> pixels(size * size * 4);
+    for (int i = 0; i < size * size; i++)
+        for (int c = 0; c < 4; c++)
+            pixels[i * 4 + c] = (GLubyte) (clamp(light[i][c], 0.0f, 1.0f) * 255 + 0.5f);
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    stateCache.bindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    stateCache.bindTexture(GL_TEXTURE_2D, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    milliseconds = (end.tv_sec - start.tv_sec) * 1e3f + (end.tv_nsec - start.tv_nsec) * 1e-6f;
+    return texture;
+}
@@ -0,0 +1,116 @@
+#ifndef lBaker
+#define lBaker
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+//include local stuff
+#include "DrawObject.hpp"
+
+using namespace glm;
+
+/*
+ * Load time lightmaps for static geometry lit by static lights.
+ *
+ * Meshes without texture coordinates are unwrapped: triangles facing about the same way are grown
+ * into charts, each chart is projected onto its plane and the charts are shelf packed into the
+ * unit square. Meshes with texture coordinates use those, they must not overlap.
+ *
+ * The baker casts rays against the static occluders (in a bounding volume hierarchy) on all CPU
+ * cores: one shadow ray per texel and light for the direct light, and LIGHTMAP_BOUNCE_SAMPLES
+ * cosine distributed rays for one bounce of indirect light off the occluders. Texels store the
+ * diffuse factor of the shaders for a white light of unit intensity (clamped to 1), the direct light
+ * in alpha and the bounced light in rgb, so the shaders can shadow the direct light by dynamic
+ * casters; they scale it by the light's current intensity and the surface color and skip the baked
+ * light otherwise, including its specular highlight.
+ */
+
+#define LIGHTMAP_SIZE 256
+
+//texels around every chart, filled from the chart's edge so filtering never reads unbaked texels
+#define LIGHTMAP_PADDING 2
+
+//triangles join a chart if their normal is within about 25 degrees of the chart's first triangle
+#define LIGHTMAP_CHART_COS 0.9f
+
+//kD of the shaders
+#define LIGHTMAP_DIFFUSE 0.5f
+
+#define LIGHTMAP_BOUNCE_SAMPLES 64
+
+//ray origins are moved off the surface by this much against self intersections
+#define LIGHTMAP_RAY_BIAS 1e-3f
+
+//triangles per leaf of the bounding volume hierarchy
+#define LIGHTMAP_LEAF_SIZE 4
+
+//texture unit of the lightmap, after the shadow maps
+#define LIGHTMAP_TEXTURE_UNIT 10
+
+//replaces the (empty) uvs with lightmap coordinates for a size x size lightmap, vertices on chart
+//borders are duplicated; returns the number of charts
+int unwrapLightmap(std::vector<GLushort> &indices, std::vector<GLfloat> &vertices, std::vector<GLfloat> &normals,
+                   std::vector<GLfloat> &uvs, std::vector<GLushort> &materials, int size);
+
+class LightmapBaker {
+private:
+    struct Triangle {
+        vec3 a, b, c;
+        vec3 albedo;
+    };
+
+    //leaves hold triangles [first, first + count), inner nodes (count 0) have their children at first, first + 1
+    struct Node {
+        vec3 boxMin, boxMax;
+        int first, count;
+    };
+
+    //rows of one bake() shared by the worker threads
+    struct BakeJob;
+
+    std::vector<Triangle> triangles;
+    std::vector<Node> nodes;
+    std::vector<vec3> lights;
+
+    void buildNode(int node, int first, int count);
+
+    //closest hit along the ray up to maxDistance
+    bool intersect(const vec3 &origin, const vec3 &direction, float maxDistance, float &distance,
+                   int &triangle) const;
+
+    //the diffuse factors of the surface point, adding the rays cast to rayCount
+    float directLight(const vec3 &position, const vec3 &normal, long &rayCount) const;
+    //bounced light in rgb, direct light in alpha
+    vec4 bakeTexel(const vec3 &position, const vec3 &normal, unsigned int seed, long &rayCount) const;
+    void bakeRows(BakeJob *job, int thread) const;
+
+public:
+    //indirect rays per texel, 0 bakes only the direct light
+    int bounceSamples;
+
+    //statistics of the last bake()
+    int threads, texels;
+    long rays;
+    float milliseconds;
+
+    LightmapBaker();
+
+    //static geometry at its current pose, casting shadows and bouncing light in its diffuse color
+    void addOccluder(const DrawObject &object, const vec3 &albedo);
+    void addLight(const vec3 &position);
+
+    //builds the hierarchy over the occluders, call after adding them
+    void build();
+
+    //bakes the object's surfaces over its uvs into a new size x size GL_RGBA8 texture
+    GLuint bake(const DrawObject &object, int size);
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MaterialTable.hpp"
+#include "StateCache.hpp"
+
+//exponent for materials without an Ns entry
+#define DEFAULT_SHININESS 8.0f
+
+MaterialTable::MaterialTable() {
+    buffer = 0;
+    dirty = true;
+    textures = 0;
+}
+
+MaterialTable::~MaterialTable() {
+    if (buffer)
+        stateCache.deleteBuffer(buffer);
+}
+
+int MaterialTable::add(const MaterialData *range, int count) {
+    for (int first = 0; first + count <= (int) materials.size(); first++)
+        if (memcmp(&materials[first], range, count * sizeof(MaterialData)) == 0)
+            return first;
+
+    if ((int) materials.size() + count > MAX_MATERIALS) {
+        fprintf(stderr, "Material table is full (%d materials)\n", MAX_MATERIALS);
+        exit(-1);
+    }
+
+    int first = (int) materials.size();
+    materials.insert(materials.end(), range, range + count);
+    dirty = true;
+    return first;
+}
+
+int MaterialTable::size() const {
+    return (int) materials.size();
+}
+
+void MaterialTable::upload() {
+    if (!dirty)
+        return;
+
+    if (buffer == 0) {
+        glGenBuffers(1, &buffer);
+        stateCache.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(MaterialData), NULL, GL_STATIC_DRAW);
+    }
+
+    stateCache.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (!materials.empty())
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, materials.size() * sizeof(MaterialData), &materials[0]);
+    stateCache.bindBufferBase(GL_UNIFORM_BUFFER, MaterialBinding, buffer);
+    dirty = false;
+}
+
+MaterialData MaterialTable::fromColors(const vec4 colors[]) {
+    MaterialData material;
+    material.ambient = colors[0];
+    material.diffuse = colors[1];
+    material.specular = colors[2];
+    material.parameters = vec4(DEFAULT_SHININESS, 1, -1, 0);
+    return material;
+}
+
+MaterialData MaterialTable::fromObj(const obj_material *mtl) {
+    MaterialData material;
+    material.ambient = vec4(mtl->amb[0], mtl->amb[1], mtl->amb[2], mtl->trans);
+    material.diffuse = vec4(mtl->diff[0], mtl->diff[1], mtl->diff[2], mtl->trans);
+    material.specular = vec4(mtl->spec[0], mtl->spec[1], mtl->spec[2], 1);
+    material.parameters = vec4(mtl->shiny > 0 ? mtl->shiny : DEFAULT_SHININESS, mtl->trans, -1, 0);
+    return material;
+}
@@ -0,0 +1,45 @@
+#ifndef mTable
+#define mTable
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include local stuff
+#include "OBJParser.h"
+#include "TextureArrays.hpp"
+#include "UniformBlocks.hpp"
+
+/*
+ * All materials of the scene in one uniform buffer ("MaterialBlock" in the shaders).
+ * Meshes store a per vertex index relative to their first table entry (ObjectData.MaterialBase),
+ * so meshes with several materials still render in a single draw.
+ */
+class MaterialTable {
+private:
+    std::vector<MaterialData> materials;
+    GLuint buffer;
+    bool dirty;
+
+public:
+    //arrays the textures of the materials are added to (see DrawObject), 0 draws all meshes with their colors
+    TextureArrays *textures;
+
+    MaterialTable();
+    ~MaterialTable();
+
+    //adds count consecutive materials, reusing an identical run if there is one; returns the first index
+    int add(const MaterialData *range, int count);
+
+    int size() const;
+
+    //(re)uploads the table if it changed and binds it to MaterialBinding
+    void upload();
+
+    //materials without a texture layer, DrawObject sets it
+    static MaterialData fromColors(const vec4 colors[]);
+    static MaterialData fromObj(const obj_material *material);
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "MeshOptimizer.hpp"
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+using namespace glm;
+
+static vec3 vertexPosition(const std::vector<GLfloat> &positions, int index) {
+    return vec3(positions[index * 3], positions[index * 3 + 1], positions[index * 3 + 2]);
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<GLushort> &indices, int vertexCount, int cacheSize) {
+    //FIFO cache: a vertex is in the cache if it was inserted less than cacheSize misses ago
+    std::vector<int> insertedAt(vertexCount, -cacheSize - 1);
+    std::vector<bool> used(vertexCount, false);
+    int misses = 0, unique = 0;
+
+    for (size_t i = 0; i < indices.size(); i++) {
+        int v = indices[i];
+        if (misses - insertedAt[v] > cacheSize) {
+            insertedAt[v] = misses;
+            misses++;
+        }
+        if (!used[v]) {
+            used[v] = true;
+            unique++;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = indices.empty() ? 0 : (float) misses / (indices.size() / 3);
+    stats.atvr = unique == 0 ? 0 : (float) misses / unique;
+    return stats;
+}
+
+int removeDegenerateTriangles(std::vector<GLushort> &indices, const std::vector<GLfloat> &positions) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        GLushort a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (a == b || b == c || a == c)
+            continue;
+
+        vec3 pa = vertexPosition(positions, a);
+        vec3 pb = vertexPosition(positions, b);
+        vec3 pc = vertexPosition(positions, c);
+        if (length(cross(pb - pa, pc - pa)) == 0)
+            continue;
+
+        indices[kept++] = a;
+        indices[kept++] = b;
+        indices[kept++] = c;
+    }
+
+    int removed = (int) (indices.size() - kept) / 3;
+    indices.resize(kept);
+    return removed;
+}
+
+void optimizeVertexCache(std::vector<GLushort> &indices, int vertexCount, int cacheSize,
+                         std::vector<int> &clusters) {
+    int triangleCount = (int) indices.size() / 3;
+    clusters.clear();
+    if (triangleCount == 0)
+        return;
+
+    //vertex -> triangle adjacency
+    std::vector<int> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < indices.size(); i++)
+        liveTriangles[indices[i]]++;
+
+    std::vector<int> offsets(vertexCount + 1, 0);
+    for (int v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + liveTriangles[v];
+
+    std::vector<int> adjacency(indices.size());
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+
+    std::vector<int> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<int> deadEnd;
+    std::vector<int> candidates;
+    std::vector<GLushort> output;
+    output.reserve(indices.size());
+
+    int fanning = 0, time = cacheSize + 1, cursor = 0;
+    while (liveTriangles[fanning] == 0)
+        fanning++;
+    clusters.push_back(0);
+
+    while (fanning >= 0) {
+        candidates.clear();
+
+        //emit all remaining triangles around the fanning vertex
+        for (int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+            int t = adjacency[a];
+            if (emitted[t])
+                continue;
+
+            for (int k = 0; k < 3; k++) {
+                int v = indices[t * 3 + k];
+                output.push_back((GLushort) v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        //next fanning vertex: the one still in the cache that stays there the longest
+        int next = -1, best = 0;
+        for (size_t c = 0; c < candidates.size(); c++) {
+            int v = candidates[c];
+            if (liveTriangles[v] == 0)
+                continue;
+
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+
+        //dead end: fall back to recently used vertices, then to the next unprocessed vertex
+        if (next == -1) {
+            while (!deadEnd.empty() && next == -1) {
+                int v = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[v] > 0)
+                    next = v;
+            }
+            while (next == -1 && cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0)
+                    next = cursor;
+                cursor++;
+            }
+
+            //continuing at a vertex that already left the cache starts a new cluster
+            if (next != -1 && time - cacheTime[next] > cacheSize)
+                clusters.push_back((int) output.size() / 3);
+        }
+
+        fanning = next;
+    }
+
+    indices.swap(output);
+}
+
+struct Cluster {
+    int first, count;
+    float occlusion;
+};
+
+static bool moreOccluding(const Cluster &a, const Cluster &b) {
+    return a.occlusion > b.occlusion;
+}
+
+void optimizeOverdraw(std::vector<GLushort> &indices, const std::vector<GLfloat> &positions,
+                      const std::vector<int> &clusters) {
+    int triangleCount = (int) indices.size() / 3;
+    if (clusters.size() < 2)
+        return;
+
+    //area weighted centroid of the whole mesh
+    vec3 meshCentroid = vec3(0);
+    float meshArea = 0;
+    for (int t = 0; t < triangleCount; t++) {
+        vec3 a = vertexPosition(positions, indices[t * 3]);
+        vec3 b = vertexPosition(positions, indices[t * 3 + 1]);
+        vec3 c = vertexPosition(positions, indices[t * 3 + 2]);
+        float area = length(cross(b - a, c - a));
+        meshCentroid += (a + b + c) / 3.0f * area;
+        meshArea += area;
+    }
+    if (meshArea > 0)
+        meshCentroid /= meshArea;
+
+    //clusters facing away from the mesh center are likely to occlude the others, so they go first
+    std::vector<Cluster> sorted(clusters.size());
+    for (size_t i = 0; i < clusters.size(); i++) {
+        Cluster &cluster = sorted[i];
+        cluster.first = clusters[i];
+        cluster.count = (i + 1 < clusters.size() ? clusters[i + 1] : triangleCount) - cluster.first;
+
+        vec3 centroid = vec3(0), normal = vec3(0);
+        float area = 0;
+        for (int t = cluster.first; t < cluster.first + cluster.count; t++) {
+            vec3 a = vertexPosition(positions, indices[t * 3]);
+            vec3 b = vertexPosition(positions, indices[t * 3 + 1]);
+            vec3 c = vertexPosition(positions, indices[t * 3 + 2]);
+            vec3 n = cross(b - a, c - a);
+            centroid += (a + b + c) / 3.0f * length(n);
+            normal += n;
+            area += length(n);
+        }
+        if (area > 0)
+            centroid /= area;
+        if (length(normal) > 0)
+            normal = normalize(normal);
+
+        cluster.occlusion = dot(centroid - meshCentroid, normal);
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), moreOccluding);
+
+    std::vector<GLushort> output;
+    output.reserve(indices.size());
+    for (size_t i = 0; i < sorted.size(); i++)
+        output.insert(output.end(), indices.begin() + sorted[i].first * 3,
+                      indices.begin() + (sorted[i].first + sorted[i].count) * 3);
+
+    indices.swap(output);
+}
+
+void optimizeVertexFetch(std::vector<GLushort> &indices, std::vector<GLfloat> &positions,
+                         std::vector<GLfloat> &normals, std::vector<GLfloat> &uvs,
+                         std::vector<GLushort> &materials) {
+    int vertexCount = (int) positions.size() / 3;
+    std::vector<int> remap(vertexCount, -1);
+    std::vector<GLfloat> newPositions, newNormals, newUVs;
+    std::vector<GLushort> newMaterials;
+    int next = 0;
+
+    for (size_t i = 0; i < indices.size(); i++) {
+        int v = indices[i];
+        if (remap[v] == -1) {
+            remap[v] = next++;
+            newPositions.insert(newPositions.end(), positions.begin() + v * 3, positions.begin() + v * 3 + 3);
+            newNormals.insert(newNormals.end(), normals.begin() + v * 3, normals.begin() + v * 3 + 3);
+            if (!uvs.empty())
+                newUVs.insert(newUVs.end(), uvs.begin() + v * 2, uvs.begin() + v * 2 + 2);
+            newMaterials.push_back(materials[v]);
+        }
+        indices[i] = (GLushort) remap[v];
+    }
+
+    positions.swap(newPositions);
+    normals.swap(newNormals);
+    uvs.swap(newUVs);
+    materials.swap(newMaterials);
+}
+
+void optimizeMesh(std::vector<GLushort> &indices, std::vector<GLfloat> &positions,
+                  std::vector<GLfloat> &normals, std::vector<GLfloat> &uvs,
+                  std::vector<GLushort> &materials) {
+    int vertexCount = (int) positions.size() / 3;
+    VertexCacheStats before = analyzeVertexCache(indices, vertexCount, VERTEX_CACHE_SIZE);
+
+    int degenerate = removeDegenerateTriangles(indices, positions);
+
+    std::vector<int> clusters;
+    optimizeVertexCache(indices, vertexCount, VERTEX_CACHE_SIZE, clusters);
+    VertexCacheStats cacheOptimized = analyzeVertexCache(indices, vertexCount, VERTEX_CACHE_SIZE);
+
+    //overdraw sorting breaks up the cache order at cluster borders, only keep it if that stays cheap
+    std::vector<GLushort> sorted(indices);
+    optimizeOverdraw(sorted, positions, clusters);
+    VertexCacheStats overdrawSorted = analyzeVertexCache(sorted, vertexCount, VERTEX_CACHE_SIZE);
+    bool keepSorted = overdrawSorted.acmr <= cacheOptimized.acmr * OVERDRAW_CACHE_THRESHOLD;
+    if (keepSorted)
+        indices.swap(sorted);
+
+    optimizeVertexFetch(indices, positions, normals, uvs, materials);
+    VertexCacheStats after = analyzeVertexCache(indices, (int) positions.size() / 3, VERTEX_CACHE_SIZE);
+
+    printf("Optimized mesh: %d triangles, %d clusters%s, %d degenerate removed, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+           (int) indices.size() / 3, (int) clusters.size(), keepSorted ? " (overdraw sorted)" : "", degenerate,
+           before.acmr, after.acmr, before.atvr, after.atvr);
+}
@@ -0,0 +1,50 @@
+#ifndef mOptimizer
+#define mOptimizer
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Load time mesh optimization:
+ *  - degenerate triangles are dropped,
+ *  - triangles are reordered for post-transform cache locality (Tipsify, Sander et al. 2007),
+ *  - the resulting clusters are sorted to draw outward facing parts first, reducing overdraw,
+ *  - vertices are renumbered in first use order for vertex fetch locality.
+ */
+
+//FIFO cache size used for the simulation and as Tipsify's target
+#define VERTEX_CACHE_SIZE 16
+
+//overdraw sorting is only kept if it raises the ACMR by less than this factor
+#define OVERDRAW_CACHE_THRESHOLD 1.05f
+
+struct VertexCacheStats {
+    float acmr; //average cache miss ratio, transformed vertices per triangle
+    float atvr; //average transform to vertex ratio, transformed vertices per unique vertex
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<GLushort> &indices, int vertexCount, int cacheSize);
+
+//returns the number of removed triangles
+int removeDegenerateTriangles(std::vector<GLushort> &indices, const std::vector<GLfloat> &positions);
+
+//reorders triangles in place; clusters receives the first triangle of every cluster
+void optimizeVertexCache(std::vector<GLushort> &indices, int vertexCount, int cacheSize,
+                         std::vector<int> &clusters);
+
+void optimizeOverdraw(std::vector<GLushort> &indices, const std::vector<GLfloat> &positions,
+                      const std::vector<int> &clusters);
+
+//renumbers vertices in order of first use and drops unreferenced ones; uvs may be empty
+void optimizeVertexFetch(std::vector<GLushort> &indices, std::vector<GLfloat> &positions,
+                         std::vector<GLfloat> &normals, std::vector<GLfloat> &uvs,
+                         std::vector<GLushort> &materials);
+
+//runs all stages and prints ACMR/ATVR before and after
+void optimizeMesh(std::vector<GLushort> &indices, std::vector<GLfloat> &positions,
+                  std::vector<GLfloat> &normals, std::vector<GLfloat> &uvs,
+                  std::vector<GLushort> &materials);
+
+#endif
@@ -0,0 +1,228 @@
+#include <math.h>
+#include <map>
+#include <queue>
+
+#include "MeshSimplifier.hpp"
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+using namespace glm;
+
+//symmetric 4x4 matrix, upper triangle
+struct Quadric {
+    double a[10];
+};
+
+struct Collapse {
+    double cost;
+    int from, to;
+    int fromVersion, toVersion;
+
+    bool operator<(const Collapse &other) const {
+        //priority_queue pops the largest element, we want the cheapest collapse
+        return cost > other.cost;
+    }
+};
+
+static void addPlane(Quadric &q, dvec3 n, double d) {
+    double p[4] = {n.x, n.y, n.z, d};
+    int k = 0;
+    for (int i = 0; i < 4; i++)
+        for (int j = i; j < 4; j++)
+            q.a[k++] += p[i] * p[j];
+}
+
+static void addQuadric(Quadric &q, const Quadric &other) {
+    for (int k = 0; k < 10; k++)
+        q.a[k] += other.a[k];
+}
+
+static double evaluate(const Quadric &q, dvec3 v) {
+    double p[4] = {v.x, v.y, v.z, 1};
+    double result = 0;
+    int k = 0;
+    for (int i = 0; i < 4; i++)
+        for (int j = i; j < 4; j++)
+            result += (i == j ? 1 : 2) * q.a[k++] * p[i] * p[j];
+    return fabs(result);
+}
+
+float simplifyMesh(const std::vector<GLushort> &indices, const std::vector<GLfloat> &positions,
+                   int targetTriangles, std::vector<GLushort> &out) {
+    int vertexCount = (int) positions.size() / 3;
+    int triangleCount = (int) indices.size() / 3;
+
+    std::vector<int> triangles(indices.begin(), indices.end());
+    std::vector<bool> triangleAlive(triangleCount, true);
+    std::vector<std::vector<int> > vertexTriangles(vertexCount);
+    std::vector<dvec3> position(vertexCount);
+    std::vector<Quadric> quadrics(vertexCount);
+    std::vector<bool> locked(vertexCount, false), collapsed(vertexCount, false);
+    std::vector<int> version(vertexCount, 0);
+
+    for (int v = 0; v < vertexCount; v++) {
+        position[v] = dvec3(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]);
+        for (int k = 0; k < 10; k++)
+            quadrics[v].a[k] = 0;
+    }
+
+    //attribute seams: several vertices share one position, moving one of them would tear the mesh
+    std::map<std::pair<double, std::pair<double, double> >, int> positionCount;
+    for (int v = 0; v < vertexCount; v++)
+        positionCount[std::make_pair(position[v].x, std::make_pair(position[v].y, position[v].z))]++;
+    for (int v = 0; v < vertexCount; v++)
+        if (positionCount[std::make_pair(position[v].x, std::make_pair(position[v].y, position[v].z))] > 1)
+            locked[v] = true;
+
+    //borders: edges used by a single triangle
+    std::map<std::pair<int, int>, int> edgeCount;
+    for (int t = 0; t < triangleCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+            edgeCount[std::make_pair(min(a, b), max(a, b))]++;
+        }
+    }
+    for (std::map<std::pair<int, int>, int>::iterator it = edgeCount.begin(); it != edgeCount.end(); ++it) {
+        if (it->second == 1) {
+            locked[it->first.first] = true;
+            locked[it->first.second] = true;
+        }
+    }
+
+    //initial quadrics from the planes of the adjacent triangles
+    for (int t = 0; t < triangleCount; t++) {
+        dvec3 a = position[triangles[t * 3]], b = position[triangles[t * 3 + 1]], c = position[triangles[t * 3 + 2]];
+        dvec3 n = cross(b - a, c - a);
+        if (length(n) == 0)
+            continue;
+        n = normalize(n);
+
+        for (int k = 0; k < 3; k++) {
+            addPlane(quadrics[triangles[t * 3 + k]], n, -dot(n, a));
+            vertexTriangles[triangles[t * 3 + k]].push_back(t);
+        }
+    }
+
+    std::priority_queue<Collapse> heap;
+    for (int t = 0; t < triangleCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+            for (int direction = 0; direction < 2; direction++) {
+                int from = direction ? b : a, to = direction ? a : b;
+                if (locked[from])
+                    continue;
+
+                Quadric q = quadrics[from];
+                addQuadric(q, quadrics[to]);
+                Collapse collapse = {evaluate(q, position[to]), from, to, 0, 0};
+                heap.push(collapse);
+            }
+        }
+    }
+
+    int liveTriangles = triangleCount;
+    double error = 0;
+
+    while (liveTriangles > targetTriangles && !heap.empty()) {
+        Collapse collapse = heap.top();
+        heap.pop();
+
+        int from = collapse.from, to = collapse.to;
+        if (collapsed[from] || collapsed[to])
+            continue;
+
+        //quadrics changed since this entry was queued, requeue with the current cost
+        if (collapse.fromVersion != version[from] || collapse.toVersion != version[to]) {
+            Quadric q = quadrics[from];
+            addQuadric(q, quadrics[to]);
+            Collapse updated = {evaluate(q, position[to]), from, to, version[from], version[to]};
+            heap.push(updated);
+            continue;
+        }
+
+        //reject collapses that flip a remaining triangle or leave from and to no longer connected
+        bool adjacent = false, flips = false;
+        for (size_t i = 0; i < vertexTriangles[from].size(); i++) {
+            int t = vertexTriangles[from][i];
+            if (!triangleAlive[t])
+                continue;
+
+            int *corner = &triangles[t * 3];
+            if (corner[0] == to || corner[1] == to || corner[2] == to) {
+                adjacent = true;
+                continue;
+            }
+
+            dvec3 p[3], moved[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = position[corner[k]];
+                moved[k] = corner[k] == from ? position[to] : p[k];
+            }
+            dvec3 before = cross(p[1] - p[0], p[2] - p[0]);
+            dvec3 after = cross(moved[1] - moved[0], moved[2] - moved[0]);
+            if (dot(before, after) <= 0)
+                flips = true;
+        }
+        if (!adjacent || flips)
+            continue;
+
+        //collapse from onto to
+        for (size_t i = 0; i < vertexTriangles[from].size(); i++) {
+            int t = vertexTriangles[from][i];
+            if (!triangleAlive[t])
+                continue;
+
+            int *corner = &triangles[t * 3];
+            if (corner[0] == to || corner[1] == to || corner[2] == to) {
+                triangleAlive[t] = false;
+                liveTriangles--;
+                continue;
+            }
+
+            for (int k = 0; k < 3; k++)
+                if (corner[k] == from)
+                    corner[k] = to;
+            vertexTriangles[to].push_back(t);
+        }
+
+        collapsed[from] = true;
+        addQuadric(quadrics[to], quadrics[from]);
+        version[to]++;
+        error = max(error, collapse.cost);
+
+        //queue the edges around the merged vertex with their new cost
+        for (size_t i = 0; i < vertexTriangles[to].size(); i++) {
+            int t = vertexTriangles[to][i];
+            if (!triangleAlive[t])
+                continue;
+
+            for (int k = 0; k < 3; k++) {
+                int other = triangles[t * 3 + k];
+                if (other == to)
+                    continue;
+
+                for (int direction = 0; direction < 2; direction++) {
+                    int a = direction ? other : to, b = direction ? to : other;
+                    if (locked[a])
+                        continue;
+
+                    Quadric q = quadrics[a];
+                    addQuadric(q, quadrics[b]);
+                    Collapse updated = {evaluate(q, position[b]), a, b, version[a], version[b]};
+                    heap.push(updated);
+                }
+            }
+        }
+    }
+
+    out.clear();
+    for (int t = 0; t < triangleCount; t++)
+        if (triangleAlive[t])
+            for (int k = 0; k < 3; k++)
+                out.push_back((GLushort) triangles[t * 3 + k]);
+
+    return (float) sqrt(error);
+}
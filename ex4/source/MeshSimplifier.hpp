@@ -0,0 +1,23 @@
+#ifndef mSimplifier
+#define mSimplifier
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Quadric error mesh simplification (Garland and Heckbert 1997).
+ * Edges are collapsed onto one of their endpoints, so the simplified mesh only needs a new
+ * index buffer and keeps using the vertex buffer of the full mesh. Vertices on borders and
+ * attribute seams (several vertices at one position) are never moved.
+ */
+
+/*
+ * Simplifies the triangle list indices to at most targetTriangles triangles, or as far as
+ * possible without flipping triangles; returns the geometric error of the result in object units.
+ */
+float simplifyMesh(const std::vector<GLushort> &indices, const std::vector<GLfloat> &positions,
+                   int targetTriangles, std::vector<GLushort> &out);
+
+#endif
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 
 #include "OBJParser.h"
+#include "CpuProfiler.h"
 
 #define WHITESPACE " \t\n\r"
 
@@ -271,7 +272,7 @@ int obj_parse_mtl_file(char *filename, list *material_list) {
         }
             // texture map
         else if (strequal(current_token, "map_Ka") && material_open) {
-            strncpy(current_mtl->texture_filename, strtok(NULL, " \t"), OBJ_FILENAME_LENGTH);
+            strncpy(current_mtl->texture_filename, strtok(NULL, WHITESPACE), OBJ_FILENAME_LENGTH);
         }
         else {
             fprintf(stderr, "Unknown command '%s' in material file %s at line %i:\n\t%s\n",
@@ -530,12 +531,16 @@ void obj_copy_to_out_storage(obj_scene_data *data_out, obj_growable_scene_data *
 int parse_obj_scene(obj_scene_data *data_out, char *filename) {
     obj_growable_scene_data growable_data;
 
+    CPU_PROFILE_BEGIN("parse_obj_scene");
     obj_init_temp_storage(&growable_data);
-    if (obj_parse_obj_file(&growable_data, filename) == 0)
+    if (obj_parse_obj_file(&growable_data, filename) == 0) {
+        CPU_PROFILE_END();
         return 0;
+    }
 
     obj_copy_to_out_storage(data_out, &growable_data);
     obj_free_temp_storage(&growable_data);
+    CPU_PROFILE_END();
     return 1;
 }
 
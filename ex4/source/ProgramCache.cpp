@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "ProgramCache.hpp"
+
+struct ProgramCacheHeader {
+    unsigned int magic, version;
+    unsigned long long key;
+    GLenum format;
+    GLint length;
+};
+
+static unsigned long long fnv1a(unsigned long long hash, const char *text) {
+    for (const unsigned char *c = (const unsigned char *) text; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    //separator, so "ab" + "c" and "a" + "bc" differ
+    hash ^= 0xFF;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+ProgramCache::ProgramCache(const char *cacheDirectory) {
+    directory = cacheDirectory;
+    hits = misses = rejected = 0;
+
+    GLint formats = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    supported = formats > 0;
+
+    if (!supported) {
+        printf("Program binaries not supported, shaders are compiled on every start\n");
+        return;
+    }
+
+    driver = std::string((const char *) glGetString(GL_VENDOR)) + "\n" + (const char *) glGetString(GL_RENDERER) +
+             "\n" + (const char *) glGetString(GL_VERSION);
+    mkdir(directory.c_str(), 0755);
+}
+
+unsigned long long ProgramCache::key(const char *vertexSource, const char *fragmentSource, const char *defines) const {
+    unsigned long long hash = 14695981039346656037ULL;
+    hash = fnv1a(hash, vertexSource);
+    hash = fnv1a(hash, fragmentSource);
+    hash = fnv1a(hash, defines);
+    hash = fnv1a(hash, driver.c_str());
+    return hash;
+}
+
+std::string ProgramCache::filename(unsigned long long hash) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", hash);
+    return directory + name;
+}
+
+GLuint ProgramCache::load(const char *vertexSource, const char *fragmentSource, const char *defines) {
+    if (!supported)
+        return 0;
+
+    unsigned long long hash = key(vertexSource, fragmentSource, defines);
+    std::string path = filename(hash);
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == 0) {
+        misses++;
+        return 0;
+    }
+
+    ProgramCacheHeader header;
+    std::vector<GLubyte> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_CACHE_MAGIC &&
+                 header.version == PROGRAM_CACHE_VERSION && header.key == hash && header.length > 0;
+    if (valid) {
+        binary.resize(header.length);
+        valid = fread(&binary[0], 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+
+    GLuint program = 0;
+    GLint linked = 0;
+    if (valid) {
+        program = glCreateProgram();
+        glProgramBinary(program, header.format, &binary[0], header.length);
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+
+    //drivers reject binaries after updates even if the version string stayed the same
+    if (!linked) {
+        if (program)
+            glDeleteProgram(program);
+        remove(path.c_str());
+        rejected++;
+        return 0;
+    }
+
+    hits++;
+    return program;
+}
+
+void ProgramCache::prepare(GLuint program) const {
+    if (supported)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void ProgramCache::store(GLuint program, const char *vertexSource, const char *fragmentSource, const char *defines) {
+    if (!supported)
+        return;
+
+    ProgramCacheHeader header;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+    if (header.length <= 0)
+        return;
+
+    std::vector<GLubyte> binary(header.length);
+    glGetProgramBinary(program, header.length, NULL, &header.format, &binary[0]);
+
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key(vertexSource, fragmentSource, defines);
+
+    //write to a temporary file first, so a crash never leaves a truncated entry behind
+    std::string path = filename(header.key), temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == 0) {
+        fprintf(stderr, "Could not write program cache entry %s\n", temporary.c_str());
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(&binary[0], 1, binary.size(), file) == binary.size();
+    fclose(file);
+
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Could not write program cache entry %s\n", path.c_str());
+        remove(temporary.c_str());
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef pCache
+#define pCache
+
+#include <string>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * On disk cache of linked program binaries (GL_ARB_get_program_binary).
+ * Entries are keyed by a 64 bit FNV-1a hash over the shader sources, the defines they were
+ * compiled with and the GL vendor, renderer and version strings, so any change of sources or
+ * driver makes a new entry. Binaries the driver rejects anyway are deleted and the caller
+ * compiles from source again.
+ */
+
+//program cache file layout: header followed by the binary
+#define PROGRAM_CACHE_MAGIC 0x4e494250u //"PBIN"
+#define PROGRAM_CACHE_VERSION 1
+
+class ProgramCache {
+private:
+    std::string directory;
+    std::string driver;
+    bool supported;
+
+    unsigned long long key(const char *vertexSource, const char *fragmentSource, const char *defines) const;
+    std::string filename(unsigned long long hash) const;
+
+public:
+    int hits, misses, rejected;
+
+    explicit ProgramCache(const char *directory);
+
+    //returns a linked program, or 0 if there is no usable entry
+    GLuint load(const char *vertexSource, const char *fragmentSource, const char *defines);
+
+    //call before glLinkProgram, so the driver keeps the binary around
+    void prepare(GLuint program) const;
+
+    //stores the binary of the linked program
+    void store(GLuint program, const char *vertexSource, const char *fragmentSource, const char *defines);
+};
+
+#endif
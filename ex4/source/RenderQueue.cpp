@@ -0,0 +1,133 @@
+#include <algorithm>
+
+#include "RenderQueue.hpp"
+#include "Lightmap.hpp"
+#include "StateCache.hpp"
+
+static bool keyLess(const DrawItem &a, const DrawItem &b) {
+    return a.key < b.key;
+}
+
+static bool depthLess(const DrawItem *a, const DrawItem *b) {
+    return (a->key & 0xFFFF) < (b->key & 0xFFFF);
+}
+
+RenderQueue::RenderQueue() {
+    binds = 0;
+    skippedBinds = 0;
+    triangles = 0;
+}
+
+void RenderQueue::clear() {
+    items.clear();
+}
+
+int RenderQueue::size() const {
+    return (int) items.size();
+}
+
+void RenderQueue::add(DrawObject *object, GLuint program, float depth) {
+    unsigned long long quantizedDepth = (unsigned long long) (clamp(depth, 0.0f, 1.0f) * 0xFFFF);
+
+    DrawItem item;
+    item.object = object;
+    item.program = program;
+    item.key = ((unsigned long long) (program & 0xFF) << 56) |
+               ((unsigned long long) (object->Texture & 0xFF) << 48) |
+               ((unsigned long long) (object->MaterialKey & 0xFFFF) << 32) |
+               ((unsigned long long) (object->vertexLayout() & 0xFFFF) << 16) |
+               quantizedDepth;
+    items.push_back(item);
+}
+
+void RenderQueue::sort() {
+    std::sort(items.begin(), items.end(), keyLess);
+}
+
+void RenderQueue::draw(FrameRing &ring, const mat4 &projectionView, GpuProfiler *profiler) {
+    bool timeObjects = profiler && profiler->perObject;
+    GLuint program = 0, texture = 0, lightmap = 0, layout = 0;
+    DrawObject *last = 0;
+
+    binds = 0;
+    skippedBinds = 0;
+    triangles = 0;
+
+    for (size_t i = 0; i < items.size(); i++) {
+        DrawObject *object = items[i].object;
+
+        if (items[i].program != program) {
+            program = items[i].program;
+            stateCache.useProgram(program);
+            binds++;
+        } else {
+            skippedBinds++;
+        }
+
+        //untextured objects don't sample, so they leave the texture binding alone; materials pick their
+        //layer of the array, so objects sharing one only bind it once
+        if (object->Texture != 0 && object->Texture != texture) {
+            texture = object->Texture;
+            stateCache.bindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            binds++;
+        } else {
+            skippedBinds++;
+        }
+
+        //lightmaps belong to single static objects, so they are not part of the key
+        if (object->Lightmap != 0 && object->Lightmap != lightmap) {
+            lightmap = object->Lightmap;
+            stateCache.activeTexture(GL_TEXTURE0 + LIGHTMAP_TEXTURE_UNIT);
+            stateCache.bindTexture(GL_TEXTURE_2D, lightmap);
+            stateCache.activeTexture(GL_TEXTURE0);
+            binds++;
+        }
+
+        //attribute arrays stay enabled between layouts, the state cache only changes what differs
+        if (last == 0 || object->vertexLayout() != layout) {
+            object->bindBuffers();
+            layout = object->vertexLayout();
+            binds++;
+        } else {
+            skippedBinds++;
+        }
+
+        triangles += object->lods[object->lod].count / 3;
+
+        int scope = timeObjects ? profiler->begin(object->Name) : -1;
+        object->drawElements(ring, projectionView);
+        if (timeObjects)
+            profiler->end(scope);
+        last = object;
+    }
+
+    if (last)
+        last->unbindBuffers();
+}
+
+void RenderQueue::drawDepth(FrameRing &ring, const mat4 &projectionView, GLuint program) {
+    //no material state here, so everything goes strictly front to back
+    std::vector<const DrawItem *> order(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+        order[i] = &items[i];
+    std::sort(order.begin(), order.end(), depthLess);
+
+    stateCache.useProgram(program);
+    stateCache.colorMask(GL_FALSE);
+
+    VertexFormat format = FloatFormat;
+    DrawObject *last = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        DrawObject *object = order[i]->object;
+        if (last == 0 || object->vbo != last->vbo || object->format != format) {
+            object->bindPositions();
+            format = object->format;
+        }
+        object->drawDepth(ring, projectionView);
+        last = object;
+    }
+
+    stateCache.colorMask(GL_TRUE);
+    if (last)
+        last->unbindBuffers();
+}
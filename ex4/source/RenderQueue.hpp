@@ -0,0 +1,55 @@
+#ifndef rQueue
+#define rQueue
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include local stuff
+#include "DrawObject.hpp"
+#include "FrameRing.hpp"
+#include "GpuProfiler.hpp"
+
+/*
+ * Draws collected per frame and sorted by a 64 bit state key, most expensive state first:
+ *
+ *   63..56 program | 55..48 texture | 47..32 material | 31..16 vertex layout | 15..0 depth
+ *
+ * Consecutive items sharing a program, texture or vertex layout skip the corresponding binds, and
+ * within one layout the items are drawn front to back so early depth testing rejects more fragments.
+ * Meshes share their vertex and index buffers (see BufferAllocator.hpp), so a layout covers many meshes.
+ * The depth pre-pass draws the same items front to back with only their position streams.
+ */
+struct DrawItem {
+    unsigned long long key;
+    DrawObject *object;
+    GLuint program;
+};
+
+class RenderQueue {
+private:
+    std::vector<DrawItem> items;
+
+public:
+    //binds done and skipped, and triangles drawn by the last draw()
+    int binds, skippedBinds;
+    int triangles;
+
+    RenderQueue();
+
+    void clear();
+    int size() const;
+
+    //depth is the view space distance, normalized to [0, 1] by the far plane
+    void add(DrawObject *object, GLuint program, float depth);
+
+    void sort();
+    //with a profiler that has perObject set, every draw is timed under the object's name
+    void draw(FrameRing &ring, const mat4 &projectionView, GpuProfiler *profiler = 0);
+
+    //depth only, with the color writes masked off
+    void drawDepth(FrameRing &ring, const mat4 &projectionView, GLuint program);
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ShaderVariants.hpp"
+#include "CpuProfiler.h"
+
+//the defines have to follow the "#version" line; "#line" keeps error messages pointing at the file
+static std::string insertDefines(const std::string &source, const std::string &defines) {
+    size_t version = source.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+    if (lineEnd == std::string::npos)
+        return defines + "#line 1\n" + source;
+
+    int line = 2;
+    for (size_t i = 0; i < version; i++)
+        if (source[i] == '\n')
+            line++;
+
+    char lineDirective[32];
+    snprintf(lineDirective, sizeof(lineDirective), "#line %d\n", line);
+    return source.substr(0, lineEnd + 1) + defines + lineDirective + source.substr(lineEnd + 1);
+}
+
+//issues the compile without waiting for it, the status is checked in finish()
+static GLuint compileShader(const std::string &code, GLenum type) {
+    GLuint shader = glCreateShader(type);
+    if (shader == 0) {
+        fprintf(stderr, "Error creating shader type %d\n", type);
+        exit(1);
+    }
+
+    const char *source = code.c_str();
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+ShaderVariants::ShaderVariants(const char *vertex, const char *fragment, ProgramCache &programCache,
+                               void (*setup)(GLuint program)) : cache(programCache) {
+    vertexSource = vertex;
+    fragmentSource = fragment;
+    setupProgram = setup;
+
+    //let the driver use as many compiler threads as it likes
+    parallel = GLEW_KHR_parallel_shader_compile;
+    if (parallel)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+}
+
+ShaderVariants::~ShaderVariants() {
+    for (std::map<int, Variant>::iterator it = variants.begin(); it != variants.end(); ++it) {
+        for (int i = 0; i < 2; i++)
+            if (it->second.shaders[i])
+                glDeleteShader(it->second.shaders[i]);
+        glDeleteProgram(it->second.program);
+    }
+}
+
+std::string ShaderVariants::defines(int features, int lights) {
+    std::string lines;
+    if (features & ShaderTextured)
+        lines += "#define TEXTURED\n";
+    if (features & ShaderAmbient)
+        lines += "#define AMBIENT\n";
+    if (features & ShaderDiffuse)
+        lines += "#define DIFFUSE\n";
+    if (features & ShaderSpecular)
+        lines += "#define SPECULAR\n";
+    if (features & ShaderClustered)
+        lines += "#define CLUSTERED\n";
+    if (features & ShaderDeferred)
+        lines += "#define DEFERRED\n";
+    if (features & ShaderShadowed)
+        lines += "#define SHADOWS\n";
+    if (features & ShaderLightmapped)
+        lines += "#define LIGHTMAPPED\n";
+
+    char count[32];
+    snprintf(count, sizeof(count), "#define LIGHT_COUNT %d\n", lights);
+    return lines + count;
+}
+
+ShaderVariants::Variant &ShaderVariants::variant(int features, int lights) {
+    request(features, lights);
+    return variants[features | lights << SHADER_FEATURE_BITS];
+}
+
+void ShaderVariants::request(int features, int lights) {
+    int key = features | lights << SHADER_FEATURE_BITS;
+    if (variants.count(key))
+        return;
+
+    CPU_PROFILE_SCOPE("request variant");
+    std::string variantDefines = defines(features, lights);
+    Variant &variant = variants[key];
+    variant.shaders[0] = variant.shaders[1] = 0;
+    variant.pending = false;
+
+    //binaries are loaded and checked right away, that does not involve the compiler
+    variant.program = cache.load(vertexSource.c_str(), fragmentSource.c_str(), variantDefines.c_str());
+    if (variant.program != 0) {
+        if (setupProgram)
+            setupProgram(variant.program);
+        return;
+    }
+
+    variant.program = glCreateProgram();
+    if (variant.program == 0) {
+        fprintf(stderr, "Error creating shader program\n");
+        exit(1);
+    }
+
+    variant.shaders[0] = compileShader(insertDefines(vertexSource, variantDefines), GL_VERTEX_SHADER);
+    variant.shaders[1] = compileShader(insertDefines(fragmentSource, variantDefines), GL_FRAGMENT_SHADER);
+    glAttachShader(variant.program, variant.shaders[0]);
+    glAttachShader(variant.program, variant.shaders[1]);
+
+    cache.prepare(variant.program);
+    glLinkProgram(variant.program);
+    variant.pending = true;
+}
+
+void ShaderVariants::finish(Variant &variant, int features, int lights) {
+    if (!variant.pending)
+        return;
+
+    CPU_PROFILE_SCOPE("finish variant");
+    std::string variantDefines = defines(features, lights);
+    GLint success = 0;
+    GLchar log[1024];
+
+    //compile errors explain link errors better, so check those first
+    for (int i = 0; i < 2; i++) {
+        glGetShaderiv(variant.shaders[i], GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(variant.shaders[i], sizeof(log), NULL, log);
+            fprintf(stderr, "Error compiling %s shader with\n%s: '%s'\n", i == 0 ? "vertex" : "fragment",
+                    variantDefines.c_str(), log);
+            exit(1);
+        }
+    }
+
+    glGetProgramiv(variant.program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(variant.program, sizeof(log), NULL, log);
+        fprintf(stderr, "Error linking shader program with\n%s: '%s'\n", variantDefines.c_str(), log);
+        exit(1);
+    }
+
+    //the program keeps the compiled code
+    for (int i = 0; i < 2; i++) {
+        glDetachShader(variant.program, variant.shaders[i]);
+        glDeleteShader(variant.shaders[i]);
+        variant.shaders[i] = 0;
+    }
+    variant.pending = false;
+
+    cache.store(variant.program, vertexSource.c_str(), fragmentSource.c_str(), variantDefines.c_str());
+
+    //uniform block bindings and uniform values start out at their defaults, also for loaded binaries
+    if (setupProgram)
+        setupProgram(variant.program);
+}
+
+GLuint ShaderVariants::get(int features, int lights) {
+    Variant &requested = variant(features, lights);
+    finish(requested, features, lights);
+    return requested.program;
+}
+
+GLuint ShaderVariants::select(int features, int lights, int fallbackFeatures) {
+    Variant &requested = variant(features, lights);
+
+    //polling the completion status never blocks, unlike the link status
+    if (requested.pending && parallel && fallbackFeatures != features) {
+        GLint complete = GL_FALSE;
+        glGetProgramiv(requested.program, GL_COMPLETION_STATUS_KHR, &complete);
+        if (!complete)
+            return get(fallbackFeatures, lights);
+    }
+
+    finish(requested, features, lights);
+    return requested.program;
+}
+
+void ShaderVariants::update() {
+    //without the extension there is no way to ask without waiting
+    if (!parallel)
+        return;
+
+    for (std::map<int, Variant>::iterator it = variants.begin(); it != variants.end(); ++it) {
+        if (!it->second.pending)
+            continue;
+
+        GLint complete = GL_FALSE;
+        glGetProgramiv(it->second.program, GL_COMPLETION_STATUS_KHR, &complete);
+        if (complete)
+            finish(it->second, it->first & ((1 << SHADER_FEATURE_BITS) - 1), it->first >> SHADER_FEATURE_BITS);
+    }
+}
+
+void ShaderVariants::finishAll() {
+    for (std::map<int, Variant>::iterator it = variants.begin(); it != variants.end(); ++it)
+        finish(it->second, it->first & ((1 << SHADER_FEATURE_BITS) - 1), it->first >> SHADER_FEATURE_BITS);
+}
+
+int ShaderVariants::size() const {
+    return (int) variants.size();
+}
+
+int ShaderVariants::pendingCount() const {
+    int pending = 0;
+    for (std::map<int, Variant>::const_iterator it = variants.begin(); it != variants.end(); ++it)
+        if (it->second.pending)
+            pending++;
+    return pending;
+}
@@ -0,0 +1,82 @@
+#ifndef sVariants
+#define sVariants
+
+#include <map>
+#include <string>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include local stuff
+#include "ProgramCache.hpp"
+
+/*
+ * Specialized programs compiled from one pair of shader sources.
+ * Every variant gets "#define" lines for its feature bits and light count inserted after the
+ * "#version" line, so disabled lighting terms and the texture lookup are compiled out instead of
+ * being multiplied by zero or branched on per fragment. Linked binaries go through the program cache.
+ *
+ * Compilation does not block: request() only issues the compile and link calls, so the driver can
+ * work on all variants at once (on its own threads with GL_KHR_parallel_shader_compile), and the
+ * status is only checked when a variant is first needed. Until then select() hands out a fallback
+ * variant that is already done. Without the extension, status queries would wait for the compiler
+ * anyway, so select() finishes the variant right away.
+ *
+ * Variants are checked and stored in the program cache when they are finished. update() finishes the
+ * ones the driver is done with even if nothing draws with them yet, and finishAll() drains the rest
+ * before exiting, so the next start loads all of them from the cache.
+ */
+
+enum ShaderFeature {
+    ShaderTextured = 1, ShaderAmbient = 2, ShaderDiffuse = 4, ShaderSpecular = 8, ShaderClustered = 16,
+    ShaderDeferred = 32, ShaderShadowed = 64, ShaderLightmapped = 128
+};
+#define SHADER_FEATURE_BITS 8
+#define SHADER_LIGHTING_TERMS (ShaderAmbient | ShaderDiffuse | ShaderSpecular)
+
+class ShaderVariants {
+private:
+    struct Variant {
+        GLuint program;
+        GLuint shaders[2];
+        bool pending; //compiling and linking, status not checked yet
+    };
+
+    std::string vertexSource, fragmentSource;
+    ProgramCache &cache;
+    std::map<int, Variant> variants;
+    bool parallel;
+
+    //called after every link or binary load, before the program is used
+    void (*setupProgram)(GLuint program);
+
+    Variant &variant(int features, int lights);
+    void finish(Variant &variant, int features, int lights);
+
+public:
+    ShaderVariants(const char *vertexSource, const char *fragmentSource, ProgramCache &cache,
+                   void (*setupProgram)(GLuint program));
+    ~ShaderVariants();
+
+    //starts compiling the variant for the features (ShaderFeature bits) and light count
+    void request(int features, int lights);
+
+    //the finished program of the variant, waits for the compiler if needed
+    GLuint get(int features, int lights);
+
+    //the variant if it is done, otherwise the (finished) fallback variant
+    GLuint select(int features, int lights, int fallbackFeatures);
+
+    //finishes the variants whose compile and link completed, never waits; call once per frame
+    void update();
+    //finishes all variants, waiting for the compiler
+    void finishAll();
+
+    int size() const;
+    int pendingCount() const;
+
+    //the "#define" lines of a variant, also part of its program cache key
+    static std::string defines(int features, int lights);
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ShadowMaps.hpp"
+#include "Frustum.hpp"
+#include "StateCache.hpp"
+
+#include "../glm/gtc/matrix_transform.hpp"
+
+ShadowMaps::ShadowMaps() {
+    cacheRenders = updates = 0;
+    draws = faceUpdates = 0;
+
+    //the scene is drawn into whatever was bound before
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &outputFramebuffer);
+
+    for (int i = 0; i < SHADOW_LIGHTS; i++) {
+        maps[i] = createCube();
+        caches[i] = 0;
+        cached[i] = false;
+        staticPose[i] = false;
+        castStatic[i] = true;
+        for (int face = 0; face < 6; face++)
+            staticOnly[i][face] = false;
+    }
+
+    glGenFramebuffers(1, &framebuffer);
+    glGenFramebuffers(1, &cacheFramebuffer);
+
+    //depth only, checked on one face; all faces have the same format
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, maps[0], 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Shadow map framebuffer is incomplete\n");
+        exit(-1);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, cacheFramebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+}
+
+ShadowMaps::~ShadowMaps() {
+    for (int i = 0; i < SHADOW_LIGHTS; i++) {
+        stateCache.deleteTexture(maps[i]);
+        if (caches[i])
+            stateCache.deleteTexture(caches[i]);
+    }
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteFramebuffers(1, &cacheFramebuffer);
+}
+
+GLuint ShadowMaps::createCube() {
+    GLuint cube;
+    glGenTextures(1, &cube);
+    stateCache.bindTexture(GL_TEXTURE_CUBE_MAP, cube);
+    for (int face = 0; face < 6; face++)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE,
+                     SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+
+    //linear filtering with comparison gives 2x2 percentage closer filtering
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    stateCache.bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return cube;
+}
+
+mat4 ShadowMaps::faceMatrix(const vec3 &position, int face) {
+    //cube map face directions and up vectors, in the order of the GL_TEXTURE_CUBE_MAP_* faces
+    static const vec3 directions[6] = {vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0),
+                                       vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1)};
+    static const vec3 ups[6] = {vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1),
+                                vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0)};
+
+    mat4 projection = perspective((float) (M_PI / 2), 1.0f, SHADOW_NEAR, SHADOW_FAR);
+    return projection * lookAt(position, position + directions[face], ups[face]);
+}
+
+void ShadowMaps::cullCasters(const std::vector<DrawObject *> &casters, const mat4 &projectionView,
+                             std::vector<DrawObject *> &visible) {
+    visible.clear();
+
+    //the faces are narrow and close to the casters, so the box is tested in object space; the world box
+    //around a turning caster would reach into most faces
+    for (size_t i = 0; i < casters.size(); i++) {
+        mat4 model = casters[i]->DispositionMatrix * casters[i]->InitialTransform;
+        if (boxVisible(extractFrustum(projectionView * model), casters[i]->BoundsMin, casters[i]->BoundsMax))
+            visible.push_back(casters[i]);
+    }
+}
+
+int ShadowMaps::drawCasters(const std::vector<DrawObject *> &casters, const mat4 &projectionView, FrameRing &ring) {
+    for (size_t i = 0; i < casters.size(); i++) {
+        casters[i]->bindPositions();
+        casters[i]->drawDepth(ring, projectionView, SHADOW_MIN_LOD);
+    }
+    return (int) casters.size();
+}
+
+void ShadowMaps::update(const vec3 positions[SHADOW_LIGHTS], const std::vector<DrawObject *> &staticCasters,
+                        const std::vector<DrawObject *> &dynamicCasters, FrameRing &ring, GLuint depthProgram,
+                        int width, int height) {
+    std::vector<DrawObject *> visibleStatic, visibleDynamic;
+    updates++;
+
+    stateCache.useProgram(depthProgram);
+    stateCache.enable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(SHADOW_OFFSET_FACTOR, SHADOW_OFFSET_UNITS);
+    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+
+    for (int i = 0; i < SHADOW_LIGHTS; i++) {
+        //without static casters there is nothing to cache, faces are cleared instead of copied
+        bool useCache = staticPose[i] && castStatic[i];
+
+        //a static light that moved after all needs a new cache
+        if (useCache && (!cached[i] || cachedPositions[i] != positions[i])) {
+            if (caches[i] == 0)
+                caches[i] = createCube();
+
+            glBindFramebuffer(GL_FRAMEBUFFER, cacheFramebuffer);
+            for (int face = 0; face < 6; face++) {
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                                       caches[i], 0);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                mat4 projectionView = faceMatrix(positions[i], face);
+                cullCasters(staticCasters, projectionView, visibleStatic);
+                draws += drawCasters(visibleStatic, projectionView, ring);
+                staticOnly[i][face] = false;
+            }
+            cached[i] = true;
+            cachedPositions[i] = positions[i];
+            cacheRenders++;
+        }
+
+        for (int face = 0; face < 6; face++) {
+            mat4 projectionView = faceMatrix(positions[i], face);
+            cullCasters(dynamicCasters, projectionView, visibleDynamic);
+            visibleStatic.clear();
+            if (!useCache && castStatic[i])
+                cullCasters(staticCasters, projectionView, visibleStatic);
+
+            //a face that already holds just the static casters is only redone for dynamic ones
+            bool onlyStatic = visibleDynamic.empty() && visibleStatic.empty();
+            if (onlyStatic && staticOnly[i][face])
+                continue;
+            staticOnly[i][face] = onlyStatic;
+            faceUpdates++;
+
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                                   maps[i], 0);
+
+            if (useCache) {
+                //start from the cached static casters
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, cacheFramebuffer);
+                glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                       GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, caches[i], 0);
+                glBlitFramebuffer(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE,
+                                  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            } else {
+                glClear(GL_DEPTH_BUFFER_BIT);
+                draws += drawCasters(visibleStatic, projectionView, ring);
+            }
+            draws += drawCasters(visibleDynamic, projectionView, ring);
+        }
+    }
+
+    //the render queue sets up its full vertex layouts again when it starts drawing
+    stateCache.disable(GL_POLYGON_OFFSET_FILL);
+    glViewport(0, 0, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+}
+
+void ShadowMaps::invalidate() {
+    for (int i = 0; i < SHADOW_LIGHTS; i++)
+        cached[i] = false;
+}
+
+void ShadowMaps::bind() const {
+    for (int i = 0; i < SHADOW_LIGHTS; i++) {
+        stateCache.activeTexture(GL_TEXTURE0 + SHADOW_TEXTURE_UNIT + i);
+        stateCache.bindTexture(GL_TEXTURE_CUBE_MAP, maps[i]);
+    }
+    stateCache.activeTexture(GL_TEXTURE0);
+}
+
+vec4 ShadowMaps::depthParameters() {
+    //window depth of the perspective projection, as a function of the distance along the face axis
+    float n = SHADOW_NEAR, f = SHADOW_FAR;
+    return vec4(-f * n / (f - n), f / (f - n), 0, 0);
+}
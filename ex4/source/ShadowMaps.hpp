@@ -0,0 +1,103 @@
+#ifndef sMaps
+#define sMaps
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+//include local stuff
+#include "DrawObject.hpp"
+#include "FrameRing.hpp"
+
+using namespace glm;
+
+/*
+ * Depth cube maps for the two fixed lights of the scene (the first SHADOW_LIGHTS scene lights),
+ * sampled with hardware comparison in the shaders.
+ *
+ * Casters are split into static and dynamic ones. For a light whose pose is static, the static
+ * casters are rendered once into a cached cube map; a face of the light's map is only touched when
+ * dynamic casters are visible from it, then the cached face is blitted into it and the dynamic
+ * casters are drawn on top. Faces without dynamic casters keep (or get once) the cached face as it
+ * is. The cache is rebuilt when the light moves after all, or after invalidate() when static
+ * geometry changed. Lights that move every frame render their casters into every face they are
+ * visible from, each frame; static casters that cannot block such a light are better left out of
+ * its map with castStatic. Lights without static casters have no cache at all, their faces are
+ * cleared and get the dynamic casters only.
+ *
+ * In this scene the only static caster is the ground, which lies below both lights and everything
+ * they light, so it can never change a shadow test: Lighting.cpp leaves it out of both maps and the
+ * cache is never rendered. It only pays off for static casters that can actually occlude.
+ */
+
+#define SHADOW_LIGHTS 2
+#define SHADOW_MAP_SIZE 512
+#define SHADOW_NEAR 0.1f
+#define SHADOW_FAR 40.0f
+
+//texture units of the maps, after the G-buffer targets
+#define SHADOW_TEXTURE_UNIT 8
+
+//casters are drawn at this level of detail or coarser, the filtered maps hide the difference
+#define SHADOW_MIN_LOD 2
+
+//depth slope scale and units against shadow acne
+#define SHADOW_OFFSET_FACTOR 2.0f
+#define SHADOW_OFFSET_UNITS 4.0f
+
+class ShadowMaps {
+private:
+    GLuint framebuffer, cacheFramebuffer;
+    GLuint maps[SHADOW_LIGHTS], caches[SHADOW_LIGHTS];
+    bool cached[SHADOW_LIGHTS];
+    //faces of the maps that hold nothing but the static casters (the cached face or, without them,
+    //the cleared one), so they can stay as they are while no dynamic caster is visible from them
+    bool staticOnly[SHADOW_LIGHTS][6];
+    vec3 cachedPositions[SHADOW_LIGHTS];
+    GLint outputFramebuffer;
+
+    static GLuint createCube();
+    static mat4 faceMatrix(const vec3 &position, int face);
+
+    //the casters whose bounds intersect the frustum of a face
+    static void cullCasters(const std::vector<DrawObject *> &casters, const mat4 &projectionView,
+                            std::vector<DrawObject *> &visible);
+    //renders the casters into the bound framebuffer
+    int drawCasters(const std::vector<DrawObject *> &casters, const mat4 &projectionView, FrameRing &ring);
+
+public:
+    //lights whose static casters are cached, the others render everything each frame
+    bool staticPose[SHADOW_LIGHTS];
+    //lights the static casters are drawn for (all by default); static pose lights without them skip the cache
+    bool castStatic[SHADOW_LIGHTS];
+
+    //since the start: static cube maps rendered, update() calls, and the caster draws and faces rendered
+    //or copied by them
+    int cacheRenders, updates;
+    long draws, faceUpdates;
+
+    ShadowMaps();
+    ~ShadowMaps();
+
+    //renders the maps of this frame with the depth program, then binds the output framebuffer again
+    void update(const vec3 positions[SHADOW_LIGHTS], const std::vector<DrawObject *> &staticCasters,
+                const std::vector<DrawObject *> &dynamicCasters, FrameRing &ring, GLuint depthProgram,
+                int width, int height);
+
+    //rebuild the caches, e.g. after static geometry moved
+    void invalidate();
+
+    //binds the maps from SHADOW_TEXTURE_UNIT on, leaves GL_TEXTURE0 active
+    void bind() const;
+
+    //scale and bias from a fragment's major axis distance to the light to the depth stored in the map
+    static vec4 depthParameters();
+};
+
+#endif
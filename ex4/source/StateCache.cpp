@@ -0,0 +1,344 @@
+#include <string.h>
+
+#include "StateCache.hpp"
+
+StateCache stateCache;
+
+StateCache::StateCache() {
+    invalidate();
+    resetStats();
+}
+
+void StateCache::invalidate() {
+    program = STATE_UNKNOWN;
+    arrayBuffer = elementArrayBuffer = uniformBuffer = STATE_UNKNOWN;
+    activeUnit = STATE_UNKNOWN;
+
+    for (int i = 0; i < STATE_CACHE_UNIFORM_BINDINGS; i++)
+        uniformBindings[i].buffer = STATE_UNKNOWN;
+    for (int i = 0; i < STATE_CACHE_TEXTURE_UNITS; i++)
+        for (int j = 0; j < STATE_CACHE_TEXTURE_TARGETS; j++)
+            textures[i][j] = STATE_UNKNOWN;
+    for (int i = 0; i < STATE_CACHE_ATTRIBUTES; i++) {
+        attributeEnabled[i] = -1;
+        attributes[i].buffer = STATE_UNKNOWN;
+    }
+
+    capabilities.clear();
+    depthFunction = STATE_UNKNOWN;
+    depthWrites = colorWrites = -1;
+    uniforms.clear();
+}
+
+void StateCache::resetStats() {
+    issued = 0;
+    eliminated = 0;
+}
+
+void StateCache::useProgram(GLuint newProgram) {
+    if (program == newProgram) {
+        eliminated++;
+        return;
+    }
+    program = newProgram;
+    glUseProgram(program);
+    issued++;
+}
+
+GLuint *StateCache::genericBuffer(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER:
+            return &arrayBuffer;
+        case GL_ELEMENT_ARRAY_BUFFER:
+            return &elementArrayBuffer;
+        case GL_UNIFORM_BUFFER:
+            return &uniformBuffer;
+        default:
+            return 0;
+    }
+}
+
+void StateCache::bindBuffer(GLenum target, GLuint buffer) {
+    GLuint *bound = genericBuffer(target);
+    if (bound && *bound == buffer) {
+        eliminated++;
+        return;
+    }
+    if (bound)
+        *bound = buffer;
+    glBindBuffer(target, buffer);
+    issued++;
+}
+
+void StateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    //indexed binds also change the generic binding
+    GLuint *bound = genericBuffer(target);
+
+    if (target == GL_UNIFORM_BUFFER && index < STATE_CACHE_UNIFORM_BINDINGS) {
+        IndexedBinding &binding = uniformBindings[index];
+        if (binding.buffer == buffer && binding.offset == offset && binding.size == size && *bound == buffer) {
+            eliminated++;
+            return;
+        }
+        binding.buffer = buffer;
+        binding.offset = offset;
+        binding.size = size;
+    }
+    if (bound)
+        *bound = buffer;
+    glBindBufferRange(target, index, buffer, offset, size);
+    issued++;
+}
+
+void StateCache::bindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+    GLuint *bound = genericBuffer(target);
+
+    //size 0 marks a whole buffer binding, no range binding can have that size
+    if (target == GL_UNIFORM_BUFFER && index < STATE_CACHE_UNIFORM_BINDINGS) {
+        IndexedBinding &binding = uniformBindings[index];
+        if (binding.buffer == buffer && binding.size == 0 && *bound == buffer) {
+            eliminated++;
+            return;
+        }
+        binding.buffer = buffer;
+        binding.offset = 0;
+        binding.size = 0;
+    }
+    if (bound)
+        *bound = buffer;
+    glBindBufferBase(target, index, buffer);
+    issued++;
+}
+
+void StateCache::deleteBuffer(GLuint buffer) {
+    if (arrayBuffer == buffer)
+        arrayBuffer = 0;
+    if (elementArrayBuffer == buffer)
+        elementArrayBuffer = 0;
+    if (uniformBuffer == buffer)
+        uniformBuffer = 0;
+    for (int i = 0; i < STATE_CACHE_UNIFORM_BINDINGS; i++)
+        if (uniformBindings[i].buffer == buffer)
+            uniformBindings[i].buffer = 0;
+
+    //attribute pointers keep referencing deleted buffers in GL, a new buffer may get the same name though
+    for (int i = 0; i < STATE_CACHE_ATTRIBUTES; i++)
+        if (attributes[i].buffer == buffer)
+            attributes[i].buffer = STATE_UNKNOWN;
+
+    glDeleteBuffers(1, &buffer);
+}
+
+void StateCache::activeTexture(GLenum unit) {
+    if (activeUnit == unit) {
+        eliminated++;
+        return;
+    }
+    activeUnit = unit;
+    glActiveTexture(unit);
+    issued++;
+}
+
+int StateCache::textureTarget(GLenum target) {
+    switch (target) {
+        case GL_TEXTURE_2D:
+            return 0;
+        case GL_TEXTURE_2D_ARRAY:
+            return 1;
+        case GL_TEXTURE_CUBE_MAP:
+            return 2;
+        case GL_TEXTURE_BUFFER:
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+void StateCache::bindTexture(GLenum target, GLuint texture) {
+    int unit = activeUnit == STATE_UNKNOWN ? -1 : (int) (activeUnit - GL_TEXTURE0);
+    int index = textureTarget(target);
+    bool tracked = index >= 0 && unit >= 0 && unit < STATE_CACHE_TEXTURE_UNITS;
+
+    if (tracked && textures[unit][index] == texture) {
+        eliminated++;
+        return;
+    }
+    if (tracked)
+        textures[unit][index] = texture;
+    glBindTexture(target, texture);
+    issued++;
+}
+
+void StateCache::deleteTexture(GLuint texture) {
+    for (int i = 0; i < STATE_CACHE_TEXTURE_UNITS; i++)
+        for (int j = 0; j < STATE_CACHE_TEXTURE_TARGETS; j++)
+            if (textures[i][j] == texture)
+                textures[i][j] = 0;
+
+    glDeleteTextures(1, &texture);
+}
+
+void StateCache::enable(GLenum capability) {
+    std::map<GLenum, bool>::iterator it = capabilities.find(capability);
+    if (it != capabilities.end() && it->second) {
+        eliminated++;
+        return;
+    }
+    capabilities[capability] = true;
+    glEnable(capability);
+    issued++;
+}
+
+void StateCache::disable(GLenum capability) {
+    std::map<GLenum, bool>::iterator it = capabilities.find(capability);
+    if (it != capabilities.end() && !it->second) {
+        eliminated++;
+        return;
+    }
+    capabilities[capability] = false;
+    glDisable(capability);
+    issued++;
+}
+
+void StateCache::depthFunc(GLenum function) {
+    if (depthFunction == function) {
+        eliminated++;
+        return;
+    }
+    depthFunction = function;
+    glDepthFunc(function);
+    issued++;
+}
+
+void StateCache::depthMask(GLboolean enabled) {
+    if (depthWrites == (enabled ? 1 : 0)) {
+        eliminated++;
+        return;
+    }
+    depthWrites = enabled ? 1 : 0;
+    glDepthMask(enabled);
+    issued++;
+}
+
+void StateCache::colorMask(GLboolean enabled) {
+    if (colorWrites == (enabled ? 1 : 0)) {
+        eliminated++;
+        return;
+    }
+    colorWrites = enabled ? 1 : 0;
+    glColorMask(enabled, enabled, enabled, enabled);
+    issued++;
+}
+
+void StateCache::enableVertexAttribArray(GLuint index) {
+    if (index < STATE_CACHE_ATTRIBUTES) {
+        if (attributeEnabled[index] == 1) {
+            eliminated++;
+            return;
+        }
+        attributeEnabled[index] = 1;
+    }
+    glEnableVertexAttribArray(index);
+    issued++;
+}
+
+void StateCache::disableVertexAttribArray(GLuint index) {
+    if (index < STATE_CACHE_ATTRIBUTES) {
+        if (attributeEnabled[index] == 0) {
+            eliminated++;
+            return;
+        }
+        attributeEnabled[index] = 0;
+    }
+    glDisableVertexAttribArray(index);
+    issued++;
+}
+
+void StateCache::setAttributePointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLboolean integer,
+                                     GLsizei stride, const void *pointer) {
+    //the pointer is relative to the buffer bound to GL_ARRAY_BUFFER at call time
+    if (index < STATE_CACHE_ATTRIBUTES) {
+        AttributePointer &attribute = attributes[index];
+        if (arrayBuffer != STATE_UNKNOWN && attribute.buffer == arrayBuffer && attribute.size == size &&
+            attribute.type == type && attribute.normalized == normalized && attribute.integer == integer &&
+            attribute.stride == stride && attribute.pointer == pointer) {
+            eliminated++;
+            return;
+        }
+        attribute.buffer = arrayBuffer;
+        attribute.size = size;
+        attribute.type = type;
+        attribute.normalized = normalized;
+        attribute.integer = integer;
+        attribute.stride = stride;
+        attribute.pointer = pointer;
+    }
+
+    if (integer)
+        glVertexAttribIPointer(index, size, type, stride, pointer);
+    else
+        glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+    issued++;
+}
+
+void StateCache::vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+                                     const void *pointer) {
+    setAttributePointer(index, size, type, normalized, GL_FALSE, stride, pointer);
+}
+
+void StateCache::vertexAttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const void *pointer) {
+    setAttributePointer(index, size, type, GL_FALSE, GL_TRUE, stride, pointer);
+}
+
+bool StateCache::uniformChanged(GLint location, const void *data, size_t size) {
+    //values of unknown programs and of removed uniforms (-1) are not cached
+    if (program == STATE_UNKNOWN || location < 0)
+        return true;
+
+    std::map<GLint, UniformValue> &values = uniforms[program];
+    std::map<GLint, UniformValue>::iterator it = values.find(location);
+    if (it != values.end() && memcmp(it->second.data, data, size) == 0) {
+        eliminated++;
+        return false;
+    }
+
+    UniformValue &value = values[location];
+    memset(value.data, 0, sizeof(value.data));
+    memcpy(value.data, data, size);
+    return true;
+}
+
+void StateCache::uniform1i(GLint location, GLint value) {
+    if (!uniformChanged(location, &value, sizeof(value)))
+        return;
+    glUniform1i(location, value);
+    issued++;
+}
+
+void StateCache::uniform1f(GLint location, GLfloat value) {
+    if (!uniformChanged(location, &value, sizeof(value)))
+        return;
+    glUniform1f(location, value);
+    issued++;
+}
+
+void StateCache::uniform3fv(GLint location, const GLfloat *value) {
+    if (!uniformChanged(location, value, 3 * sizeof(GLfloat)))
+        return;
+    glUniform3fv(location, 1, value);
+    issued++;
+}
+
+void StateCache::uniform4fv(GLint location, const GLfloat *value) {
+    if (!uniformChanged(location, value, 4 * sizeof(GLfloat)))
+        return;
+    glUniform4fv(location, 1, value);
+    issued++;
+}
+
+void StateCache::uniformMatrix4fv(GLint location, const GLfloat *value) {
+    if (!uniformChanged(location, value, 16 * sizeof(GLfloat)))
+        return;
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+    issued++;
+}
@@ -0,0 +1,118 @@
+#ifndef sCache
+#define sCache
+
+#include <map>
+#include <stddef.h>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Thin tracking layer over the GL state the project touches: program, buffer bindings
+ * (generic and indexed uniform bindings), texture units, capabilities, depth function and
+ * write masks, vertex attribute arrays and uniforms of the current program.
+ * Calls that would not change the tracked state are dropped and counted, the rest are forwarded.
+ * All state changes have to go through the cache (or be followed by invalidate()), otherwise
+ * the cached values go stale.
+ */
+
+#define STATE_CACHE_TEXTURE_UNITS 16
+//GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_CUBE_MAP and GL_TEXTURE_BUFFER
+#define STATE_CACHE_TEXTURE_TARGETS 4
+#define STATE_CACHE_UNIFORM_BINDINGS 16
+#define STATE_CACHE_ATTRIBUTES 16
+
+//cached value of state that was never set through the cache
+#define STATE_UNKNOWN 0xFFFFFFFFu
+
+class StateCache {
+private:
+    struct IndexedBinding {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    struct AttributePointer {
+        GLuint buffer;
+        GLint size;
+        GLenum type;
+        GLboolean normalized, integer;
+        GLsizei stride;
+        const void *pointer;
+    };
+
+    //uniform values of one program location, up to a mat4
+    struct UniformValue {
+        GLfloat data[16];
+    };
+
+    GLuint program;
+    GLuint arrayBuffer, elementArrayBuffer, uniformBuffer;
+    IndexedBinding uniformBindings[STATE_CACHE_UNIFORM_BINDINGS];
+    GLenum activeUnit;
+    GLuint textures[STATE_CACHE_TEXTURE_UNITS][STATE_CACHE_TEXTURE_TARGETS];
+    int attributeEnabled[STATE_CACHE_ATTRIBUTES]; //-1 until first set
+    AttributePointer attributes[STATE_CACHE_ATTRIBUTES];
+    std::map<GLenum, bool> capabilities;
+    GLenum depthFunction;
+    int depthWrites, colorWrites; //-1 until first set
+    std::map<GLuint, std::map<GLint, UniformValue> > uniforms;
+
+    GLuint *genericBuffer(GLenum target);
+    //index into textures of the unit, -1 for untracked targets
+    static int textureTarget(GLenum target);
+    bool uniformChanged(GLint location, const void *data, size_t size);
+    void setAttributePointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLboolean integer,
+                             GLsizei stride, const void *pointer);
+
+public:
+    //calls forwarded to GL and calls dropped as redundant, since the last resetStats()
+    int issued, eliminated;
+
+    StateCache();
+
+    //forget everything, e.g. after state was changed behind the cache's back
+    void invalidate();
+    void resetStats();
+
+    void useProgram(GLuint program);
+
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    //deletes and clears all cached bindings of buffer, like GL does
+    void deleteBuffer(GLuint buffer);
+
+    void activeTexture(GLenum unit);
+    //tracked per unit and target, binds to other targets are always forwarded
+    void bindTexture(GLenum target, GLuint texture);
+    //deletes and clears the cached bindings of texture, like GL does
+    void deleteTexture(GLuint texture);
+
+    void enable(GLenum capability);
+    void disable(GLenum capability);
+
+    void depthFunc(GLenum function);
+    void depthMask(GLboolean enabled);
+    //all four channels at once
+    void colorMask(GLboolean enabled);
+
+    void enableVertexAttribArray(GLuint index);
+    void disableVertexAttribArray(GLuint index);
+    void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+                             const void *pointer);
+    void vertexAttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const void *pointer);
+
+    //uniforms of the current program
+    void uniform1i(GLint location, GLint value);
+    void uniform1f(GLint location, GLfloat value);
+    void uniform3fv(GLint location, const GLfloat *value);
+    void uniform4fv(GLint location, const GLfloat *value);
+    void uniformMatrix4fv(GLint location, const GLfloat *value);
+};
+
+//the cache for the one GL context of the program
+extern StateCache stateCache;
+
+#endif
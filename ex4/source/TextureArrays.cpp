@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "TextureArrays.hpp"
+#include "KtxFile.hpp"
+#include "StateCache.hpp"
+
+TextureArrays::TextureArrays() {
+    layerCount = 0;
+    bytes = 0;
+}
+
+TextureArrays::~TextureArrays() {
+    for (size_t i = 0; i < groups.size(); i++) {
+        stateCache.deleteTexture(groups[i].array);
+        if (groups[i].reloaded)
+            stateCache.deleteTexture(groups[i].reloaded);
+        for (size_t j = 0; j < groups[i].images.size(); j++)
+            free(groups[i].images[j].data);
+    }
+}
+
+TextureLayer TextureArrays::add(const std::string &file) {
+    std::map<std::string, TextureLayer>::iterator found = layers.find(file);
+    if (found != layers.end())
+        return found->second;
+
+    Group texture;
+    texture.baked = false;
+    texture.array = texture.reloaded = 0;
+
+    //the baked file replaces the extension with .ktx
+    std::string bakedFile = file.substr(0, file.rfind('.')) + ".ktx";
+    KtxFile ktx;
+    if (mapKtx(bakedFile.c_str(), ktx)) {
+        if (TextureStreamer::formatSupported(ktx.internalFormat)) {
+            texture.baked = true;
+            texture.type = ktx.type;
+            texture.format = ktx.format;
+            texture.internalFormat = ktx.internalFormat;
+            texture.width = ktx.width;
+            texture.height = ktx.height;
+            texture.levels = (int) ktx.levels.size();
+            for (int i = 0; i < texture.levels; i++)
+                texture.levelSizes.push_back(ktx.levels[i].size);
+        } else {
+            printf("%s: texture format 0x%x is not supported by the driver\n", bakedFile.c_str(), ktx.internalFormat);
+        }
+        unmapKtx(ktx);
+    }
+
+    TextureData image;
+    if (!texture.baked) {
+        if (!LoadTexture(file.c_str(), &image)) {
+            printf("Error loading texture %s. Exiting.\n", file.c_str());
+            exit(-1);
+        }
+        texture.type = GL_UNSIGNED_BYTE;
+        texture.format = GL_BGR;
+        texture.internalFormat = GL_RGB8;
+        texture.width = image.width;
+        texture.height = image.height;
+        texture.levels = 0;
+        for (int size = std::max(texture.width, texture.height); size > 0; size /= 2)
+            texture.levels++;
+    }
+
+    size_t i = 0;
+    while (i < groups.size() &&
+           (groups[i].baked != texture.baked || groups[i].internalFormat != texture.internalFormat ||
+            groups[i].width != texture.width || groups[i].height != texture.height ||
+            groups[i].levels != texture.levels))
+        i++;
+    if (i == groups.size()) {
+        glGenTextures(1, &texture.array);
+        groups.push_back(texture);
+    }
+
+    Group &group = groups[i];
+    TextureLayer layer;
+    layer.array = group.array;
+    layer.layer = (int) group.files.size();
+    group.files.push_back(texture.baked ? bakedFile : file);
+    if (!texture.baked)
+        group.images.push_back(image);
+
+    layers[file] = layer;
+    return layer;
+}
+
+void TextureArrays::allocate(const Group &group, GLuint array) {
+    stateCache.bindTexture(GL_TEXTURE_2D_ARRAY, array);
+    int depth = (int) group.files.size();
+
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, group.levels, group.internalFormat, group.width, group.height, depth);
+    } else {
+        for (int level = 0; level < group.levels; level++) {
+            int width = std::max(1, group.width >> level), height = std::max(1, group.height >> level);
+            if (group.baked && group.type == 0)
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, group.internalFormat, width, height, depth, 0,
+                                       group.levelSizes[level] * depth, NULL);
+            else
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, group.internalFormat, width, height, depth, 0,
+                             group.format, group.type, NULL);
+        }
+    }
+
+    /* Repeat texture on edges when tiling */
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    /* Linear interpolation for magnification, trilinear MIP mapping for minification */
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, group.levels - 1);
+}
+
+void TextureArrays::build(TextureStreamer &streamer) {
+    layerCount = 0;
+    bytes = 0;
+
+    for (size_t i = 0; i < groups.size(); i++) {
+        Group &group = groups[i];
+        int depth = (int) group.files.size();
+        allocate(group, group.array);
+        layerCount += depth;
+
+        if (group.baked) {
+            for (int layer = 0; layer < depth; layer++)
+                streamer.request(group.array, group.files[layer].c_str(), layer);
+            for (int level = 0; level < group.levels; level++)
+                bytes += (long) group.levelSizes[level] * depth;
+            continue;
+        }
+
+        for (int layer = 0; layer < depth; layer++) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, group.width, group.height, 1, group.format,
+                            group.type, group.images[layer].data);
+            free(group.images[layer].data);
+        }
+        group.images.clear();
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+        //uncompressed RGB is stored as RGBA by the drivers
+        for (int level = 0; level < group.levels; level++)
+            bytes += (long) std::max(1, group.width >> level) * std::max(1, group.height >> level) * 4 * depth;
+    }
+}
+
+int TextureArrays::arrayCount() const {
+    return (int) groups.size();
+}
+
+void TextureArrays::reload(TextureStreamer &streamer) {
+    for (size_t i = 0; i < groups.size(); i++) {
+        Group &group = groups[i];
+        if (!group.baked || group.reloaded != 0)
+            continue;
+
+        //a file baked again with another format or size belongs into another array
+        bool unchanged = true;
+        for (size_t layer = 0; layer < group.files.size(); layer++) {
+            KtxFile ktx;
+            if (!mapKtx(group.files[layer].c_str(), ktx))
+                unchanged = false;
+            else if (ktx.internalFormat != group.internalFormat || ktx.width != group.width ||
+                     ktx.height != group.height || (int) ktx.levels.size() != group.levels)
+                unchanged = false;
+            unmapKtx(ktx);
+            if (!unchanged) {
+                printf("%s changed its format or size, restart to load it\n", group.files[layer].c_str());
+                break;
+            }
+        }
+        if (!unchanged)
+            continue;
+
+        glGenTextures(1, &group.reloaded);
+        allocate(group, group.reloaded);
+        for (size_t layer = 0; layer < group.files.size(); layer++)
+            streamer.request(group.reloaded, group.files[layer].c_str(), (int) layer);
+    }
+}
+
+bool TextureArrays::reloading() const {
+    for (size_t i = 0; i < groups.size(); i++)
+        if (groups[i].reloaded != 0)
+            return true;
+    return false;
+}
+
+bool TextureArrays::finishReload(TextureStreamer &streamer, std::vector<std::pair<GLuint, GLuint> > &replaced) {
+    for (size_t i = 0; i < groups.size(); i++)
+        if (groups[i].reloaded != 0 && streamer.state(groups[i].reloaded) == StreamLoading)
+            return false;
+
+    for (size_t i = 0; i < groups.size(); i++) {
+        Group &group = groups[i];
+        if (group.reloaded == 0)
+            continue;
+
+        if (streamer.state(group.reloaded) == StreamLoaded) {
+            replaced.push_back(std::make_pair(group.array, group.reloaded));
+            for (std::map<std::string, TextureLayer>::iterator it = layers.begin(); it != layers.end(); ++it)
+                if (it->second.array == group.array)
+                    it->second.array = group.reloaded;
+            stateCache.deleteTexture(group.array);
+            group.array = group.reloaded;
+        } else {
+            stateCache.deleteTexture(group.reloaded);
+        }
+        group.reloaded = 0;
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef tArrays
+#define tArrays
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include local stuff
+#include "LoadTexture.h"
+#include "TextureStreamer.hpp"
+
+/*
+ * Packs the textures of the scene into GL_TEXTURE_2D_ARRAYs, one per combination of format, size
+ * and number of mip levels, so that all materials whose textures share an array draw with one
+ * texture binding; the material table stores the layer of each material (MaterialData.parameters.z).
+ *
+ * Textures are named by their BMP file. The KTX file next to it baked by TextureBaker (same name,
+ * .ktx) is used when the driver supports its format and is streamed into its layer; otherwise the
+ * BMP is loaded as RGB with mip levels generated by the driver.
+ */
+
+//where a texture ended up
+struct TextureLayer {
+    GLuint array;
+    int layer;
+};
+
+class TextureArrays {
+private:
+    struct Group {
+        bool baked;
+        GLenum type, format, internalFormat;
+        int width, height, levels;
+        std::vector<GLsizei> levelSizes;
+        //streamed files of baked groups, images of BMP groups, by layer
+        std::vector<std::string> files;
+        std::vector<TextureData> images;
+        GLuint array, reloaded;
+    };
+
+    std::vector<Group> groups;
+    std::map<std::string, TextureLayer> layers;
+
+    void allocate(const Group &group, GLuint array);
+
+public:
+    //texture of the meshes with uvs whose materials have none, set before adding meshes
+    std::string defaultFile;
+
+    //statistics of build()
+    int layerCount;
+    long bytes;
+
+    TextureArrays();
+    ~TextureArrays();
+
+    //the layer of the texture, added to the array of its format unless it already is in one
+    TextureLayer add(const std::string &file);
+
+    //allocates the arrays and starts streaming the baked layers, BMP layers are uploaded right away;
+    //call streamer.finish() before drawing with them
+    void build(TextureStreamer &streamer);
+    int arrayCount() const;
+
+    //streams all baked layers again into new arrays, for files that kept their format and size
+    void reload(TextureStreamer &streamer);
+    bool reloading() const;
+    //once the streamer is done, the arrays that were reloaded as pairs of the old and new name; the
+    //old ones are deleted
+    bool finishReload(TextureStreamer &streamer, std::vector<std::pair<GLuint, GLuint> > &replaced);
+};
+
+#endif
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "TextureStreamer.hpp"
+#include "KtxFile.hpp"
+#include "StateCache.hpp"
+
+TextureStreamer::TextureStreamer() {
+    uploadedBytes = maxFrameBytes = 0;
+    uploadedBands = texturesLoaded = texturesFailed = 0;
+    loading = 0;
+    stopping = false;
+    textureStorage = GLEW_ARB_texture_storage;
+
+    GLsizeiptr size = (GLsizeiptr) STREAM_SLOT_SIZE * STREAM_SLOTS;
+    glGenBuffers(1, &buffer);
+    stateCache.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+
+    persistent = GLEW_ARB_buffer_storage;
+    if (persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+        mapped = (GLubyte *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+        if (mapped == 0) {
+            fprintf(stderr, "Could not map texture staging buffer\n");
+            exit(-1);
+        }
+    } else {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        mapped = (GLubyte *) malloc(size);
+    }
+    //unpacking from client memory everywhere else
+    stateCache.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    for (int i = STREAM_SLOTS - 1; i >= 0; i--)
+        freeSlots.push_back(i);
+    for (int i = 0; i < STREAM_WORKERS; i++)
+        workers.push_back(std::thread(&TextureStreamer::work, this));
+}
+
+TextureStreamer::~TextureStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    requestAdded.notify_all();
+    slotFreed.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    releaseSlots(true);
+
+    if (persistent) {
+        stateCache.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        stateCache.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        free(mapped);
+    }
+    stateCache.deleteBuffer(buffer);
+}
+
+bool TextureStreamer::formatSupported(GLenum internalFormat) {
+    switch (internalFormat) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return GLEW_EXT_texture_compression_s3tc;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+            return GLEW_ARB_texture_compression_bptc;
+        default:
+            return true;
+    }
+}
+
+void TextureStreamer::request(GLuint texture, const char *path, int layer) {
+    if (pending[texture]++ == 0)
+        states[texture] = StreamLoading;
+    loading++;
+
+    Request request;
+    request.texture = texture;
+    request.path = path;
+    request.layer = layer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.push_back(request);
+    }
+    requestAdded.notify_one();
+}
+
+StreamState TextureStreamer::state(GLuint texture) const {
+    std::map<GLuint, StreamState>::const_iterator found = states.find(texture);
+    return found == states.end() ? StreamFailed : found->second;
+}
+
+void TextureStreamer::work() {
+    while (true) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (requests.empty() && !stopping)
+                requestAdded.wait(lock);
+            if (stopping)
+                return;
+            request = requests.front();
+            requests.pop_front();
+        }
+        stream(request);
+    }
+}
+
+int TextureStreamer::acquireSlot() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (freeSlots.empty() && !stopping)
+        slotFreed.wait(lock);
+    if (stopping)
+        return -1;
+
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+}
+
+void TextureStreamer::stream(const Request &request) {
+    Band band;
+    band.texture = request.texture;
+    band.layer = request.layer;
+    band.levels = 0;
+    band.slot = -1;
+
+    KtxFile ktx;
+    bool usable = mapKtx(request.path.c_str(), ktx);
+    if (usable && !formatSupported(ktx.internalFormat)) {
+        printf("%s: texture format 0x%x is not supported by the driver\n", request.path.c_str(), ktx.internalFormat);
+        usable = false;
+    }
+
+    //compressed levels are split at rows of blocks, a row has to fit a slot
+    int rowHeight = usable && ktx.compressed() ? 4 : 1;
+    for (size_t i = 0; usable && i < ktx.levels.size(); i++) {
+        const KtxLevel &level = ktx.levels[i];
+        if (level.size / ((level.height + rowHeight - 1) / rowHeight) > STREAM_SLOT_SIZE) {
+            printf("%s: rows of level %d are larger than a staging slot\n", request.path.c_str(), (int) i);
+            usable = false;
+        }
+    }
+
+    if (!usable) {
+        unmapKtx(ktx);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            staged.push_back(band);
+        }
+        bandStaged.notify_one();
+        return;
+    }
+
+    band.type = ktx.type;
+    band.format = ktx.format;
+    band.internalFormat = ktx.internalFormat;
+    band.width = ktx.width;
+    band.height = ktx.height;
+    band.levels = (int) ktx.levels.size();
+
+    //smallest level first, so the texture is usable early
+    for (int i = band.levels - 1; i >= 0; i--) {
+        const KtxLevel &level = ktx.levels[i];
+        int rowCount = (level.height + rowHeight - 1) / rowHeight;
+        GLsizei rowSize = level.size / rowCount;
+        int rowsPerBand = std::max(1, (int) (STREAM_SLOT_SIZE / rowSize));
+
+        for (int first = 0; first < rowCount; first += rowsPerBand) {
+            int count = std::min(rowsPerBand, rowCount - first);
+            band.slot = acquireSlot();
+            if (band.slot < 0) {
+                unmapKtx(ktx);
+                return;
+            }
+            //page faults of the mapped file happen here, not on the render thread
+            memcpy(mapped + (GLsizeiptr) band.slot * STREAM_SLOT_SIZE, level.data + (size_t) first * rowSize,
+                   (size_t) count * rowSize);
+
+            band.level = i;
+            band.y = first * rowHeight;
+            band.rows = std::min(count * rowHeight, level.height - band.y);
+            band.size = count * rowSize;
+            band.levelSize = level.size;
+            band.lastOfLevel = first + count >= rowCount;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                staged.push_back(band);
+            }
+            bandStaged.notify_one();
+        }
+    }
+    unmapKtx(ktx);
+}
+
+void TextureStreamer::releaseSlots(bool wait) {
+    while (!inFlight.empty()) {
+        GLenum result = glClientWaitSync(inFlight.front().first, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000 : 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            if (!wait)
+                return;
+            continue;
+        }
+        if (result == GL_WAIT_FAILED)
+            fprintf(stderr, "Waiting for texture uploads failed\n");
+
+        glDeleteSync(inFlight.front().first);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const std::vector<int> &slots = inFlight.front().second;
+            freeSlots.insert(freeSlots.end(), slots.begin(), slots.end());
+        }
+        slotFreed.notify_all();
+        inFlight.pop_front();
+    }
+}
+
+//one request of texture is done, the texture is once all of them are
+void TextureStreamer::finishRequest(GLuint texture, bool loaded) {
+    loading--;
+    if (!loaded)
+        states[texture] = StreamFailed;
+    if (--pending[texture] > 0)
+        return;
+
+    pending.erase(texture);
+    if (states[texture] == StreamLoading) {
+        states[texture] = StreamLoaded;
+        texturesLoaded++;
+    } else {
+        texturesFailed++;
+    }
+}
+
+void TextureStreamer::upload(const Band &band) {
+    if (band.levels == 0) {
+        finishRequest(band.texture, false);
+        return;
+    }
+
+    GLenum target = band.layer >= 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    stateCache.bindTexture(target, band.texture);
+    int width = std::max(1, band.width >> band.level), height = std::max(1, band.height >> band.level);
+    bool compressed = band.type == 0;
+
+    //2D textures get the storage of all levels with their first band, or of each level with its first
+    //band; array layers go into the caller's storage
+    if (band.layer < 0 && textureStorage && band.level == band.levels - 1 && band.y == 0) {
+        glTexStorage2D(GL_TEXTURE_2D, band.levels, band.internalFormat, band.width, band.height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, band.levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, band.levels - 1);
+    } else if (band.layer < 0 && !textureStorage && band.y == 0) {
+        if (compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, band.level, band.internalFormat, width, height, 0, band.levelSize,
+                                   NULL);
+        else
+            glTexImage2D(GL_TEXTURE_2D, band.level, band.internalFormat, width, height, 0, band.format, band.type,
+                         NULL);
+        if (band.level == band.levels - 1) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, band.levels - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, band.levels - 1);
+        }
+    }
+
+    //the data pointer is the band's offset in the staging buffer
+    GLintptr offset = (GLintptr) band.slot * STREAM_SLOT_SIZE;
+    stateCache.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    if (!persistent)
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, band.size, mapped + offset);
+    if (band.layer >= 0 && compressed)
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, band.level, 0, band.y, band.layer, width, band.rows, 1,
+                                  band.internalFormat, band.size, (const void *) offset);
+    else if (band.layer >= 0)
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, band.level, 0, band.y, band.layer, width, band.rows, 1, band.format,
+                        band.type, (const void *) offset);
+    else if (compressed)
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, band.level, 0, band.y, width, band.rows, band.internalFormat,
+                                  band.size, (const void *) offset);
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, band.level, 0, band.y, width, band.rows, band.format, band.type,
+                        (const void *) offset);
+    stateCache.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    //the layers of an array complete at different times, so arrays are only used once complete
+    if (band.lastOfLevel && band.layer < 0)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, band.level);
+    if (band.lastOfLevel && band.level == 0)
+        finishRequest(band.texture, true);
+    uploadedBands++;
+}
+
+long TextureStreamer::uploadStaged(long budget) {
+    std::vector<int> slots;
+    long bytes = 0;
+
+    while (true) {
+        //the first band of an update() is uploaded even if it is larger than the budget
+        Band band;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (staged.empty() || (budget >= 0 && bytes > 0 && bytes + staged.front().size > budget))
+                break;
+            band = staged.front();
+            staged.pop_front();
+        }
+        upload(band);
+        if (band.slot >= 0) {
+            slots.push_back(band.slot);
+            bytes += band.size;
+        }
+    }
+
+    if (!slots.empty())
+        inFlight.push_back(std::make_pair(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), slots));
+    uploadedBytes += bytes;
+    return bytes;
+}
+
+void TextureStreamer::update() {
+    if (loading == 0)
+        return;
+    releaseSlots(false);
+    maxFrameBytes = std::max(maxFrameBytes, uploadStaged(STREAM_FRAME_BUDGET));
+}
+
+void TextureStreamer::finish() {
+    while (loading > 0) {
+        //workers waiting for slots need the ones still in flight
+        releaseSlots(true);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (staged.empty())
+                bandStaged.wait(lock);
+        }
+        uploadStaged(-1);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef tStream
+#define tStream
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+/*
+ * Loads KTX textures (see KtxFile.hpp) without stalling the render thread.
+ *
+ * Worker threads map the files and copy them into the slots of a staging ring, the smallest mip level
+ * first and in bands of rows that fit a slot. The ring is one GL_PIXEL_UNPACK_BUFFER, persistently
+ * mapped with ARB_buffer_storage; otherwise the slots are client memory that is copied into the
+ * buffer with glBufferSubData before the upload. Once per frame, update() uploads staged bands with
+ * glTexSubImage2D / glCompressedTexSubImage2D from their offset in the buffer until
+ * STREAM_FRAME_BUDGET bytes are done, and fences them; the slots go back to the workers once their
+ * fence has passed. A texture can be drawn from its first complete level on, since
+ * GL_TEXTURE_BASE_LEVEL follows the finest level uploaded so far. Files can also be streamed into
+ * a layer of a GL_TEXTURE_2D_ARRAY whose storage is already allocated (see TextureArrays.hpp).
+ */
+
+//staging ring of STREAM_SLOTS slots, each holds one band
+#define STREAM_SLOT_SIZE (256 << 10)
+#define STREAM_SLOTS 16
+
+//bytes uploaded by one update(), at least one band
+#define STREAM_FRAME_BUDGET (1 << 20)
+
+#define STREAM_WORKERS 2
+
+enum StreamState {
+    StreamLoading,
+    StreamLoaded,
+    StreamFailed
+};
+
+class TextureStreamer {
+private:
+    //rows [y, y + rows) of one level staged in a slot, the first one of a 2D texture allocates its
+    //storage; a band with levels 0 reports a file that could not be loaded
+    struct Band {
+        GLuint texture;
+        int layer; //-1 for 2D textures
+        GLenum type, format, internalFormat;
+        int width, height, levels;
+        int level, y, rows, slot;
+        GLsizei size, levelSize;
+        bool lastOfLevel;
+    };
+
+    struct Request {
+        GLuint texture;
+        int layer;
+        std::string path;
+    };
+
+    GLuint buffer;
+    GLubyte *mapped;
+    bool persistent, textureStorage;
+
+    //shared with the workers
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable requestAdded, bandStaged, slotFreed;
+    std::deque<Request> requests;
+    std::deque<Band> staged;
+    std::vector<int> freeSlots;
+    bool stopping;
+
+    //render thread only: slots of the uploads of one update() with their fence, the requested textures
+    //with the number of their requests still loading, and the number of all requests still loading
+    std::deque<std::pair<GLsync, std::vector<int> > > inFlight;
+    std::map<GLuint, StreamState> states;
+    std::map<GLuint, int> pending;
+    int loading;
+
+    void work();
+    void stream(const Request &request);
+    //blocks until a slot is free, -1 when stopping
+    int acquireSlot();
+
+    void releaseSlots(bool wait);
+    //returns the bytes uploaded, a negative budget uploads everything staged
+    long uploadStaged(long budget);
+    void upload(const Band &band);
+    void finishRequest(GLuint texture, bool loaded);
+
+public:
+    //statistics since the start
+    long uploadedBytes, maxFrameBytes; //the maximum of update(), finish() has no budget
+    int uploadedBands, texturesLoaded, texturesFailed;
+
+    TextureStreamer();
+    ~TextureStreamer();
+
+    //starts loading the KTX file into texture, a name from glGenTextures that has no storage yet, or into
+    //layer of an array texture with storage of the file's format, size and levels
+    void request(GLuint texture, const char *path, int layer = -1);
+    StreamState state(GLuint texture) const;
+
+    //uploads up to STREAM_FRAME_BUDGET bytes of staged bands, call once per frame
+    void update();
+    //waits for all requested textures and uploads them without a budget, e.g. at startup
+    void finish();
+
+    //whether the driver can sample the (compressed) internal format
+    static bool formatSupported(GLenum internalFormat);
+};
+
+#endif
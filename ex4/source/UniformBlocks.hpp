@@ -0,0 +1,66 @@
+#ifndef uBlocks
+#define uBlocks
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+using namespace glm;
+
+/*
+ * CPU side mirrors of the std140 uniform blocks declared in the shaders.
+ * Every member is a (i)vec4 or mat4, so the C++ layout matches std140 without padding.
+ */
+
+//binding points, set with glUniformBlockBinding after linking
+enum UniformBinding {
+    FrameBinding = 0, ObjectBinding = 1, MaterialBinding = 2
+};
+
+//size of the material table, MAX_MATERIALS * sizeof(MaterialData) has to stay below 16KB
+#define MAX_MATERIALS 128
+
+//lights in "FrameBlock", the shaders loop over the first LIGHT_COUNT of them
+#define MAX_LIGHTS 2
+
+//one light of "FrameBlock"
+struct LightData {
+    vec4 position;
+    vec4 intensity;
+};
+
+//cluster grid of the clustered and deferred paths (see LightClusters.hpp)
+struct ClusterData {
+    vec4 grid;  //x, y, z: clusters, w: lights
+    vec4 depth; //x: near plane, y: far plane, z, w: scale and bias from log(depth) to slice
+    vec4 tile;  //x, y: tile size in pixels
+};
+
+//constants of one frame shared by all programs, "FrameBlock" in the shaders
+struct FrameData {
+    mat4 InverseProjectionViewMatrix;
+    vec4 CameraPosition; //w: 1
+    ClusterData clusters;
+    vec4 shadowDepth; //see ShadowMaps::depthParameters()
+    LightData lights[MAX_LIGHTS];
+};
+
+//per draw object data, "ObjectBlock" in the shaders; both matrices include the decoding of
+//quantized positions, so the vertex shader applies them to the vertex position as it is
+struct ObjectData {
+    mat4 ModelViewProjectionMatrix;
+    mat4 ModelMatrix;
+    ivec4 MaterialBase; //x: table index of the mesh's material 0
+};
+
+//one entry of "MaterialBlock"; parameters.x is the specular exponent, parameters.y the transparency,
+//parameters.z the layer of the material's texture in the array bound with the mesh or -1
+struct MaterialData {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    vec4 parameters;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "VertexFormat.hpp"
+#include "StateCache.hpp"
+
+#include "../glm/gtc/packing.hpp"
+
+using namespace glm;
+
+GLsizei vertexStride(VertexFormat format) {
+    if (format == PackedFormat)
+        return sizeof(PackedVertex);
+    return sizeof(FloatVertex);
+}
+
+GLsizei positionStride(VertexFormat format) {
+    if (format == PackedFormat)
+        return sizeof(PackedPosition);
+    return 3 * sizeof(GLfloat);
+}
+
+VertexError packVertices(VertexFormat format, const std::vector<GLfloat> &positions,
+                         const std::vector<GLfloat> &normals, const std::vector<GLfloat> &uvs,
+                         const std::vector<GLushort> &materials,
+                         std::vector<GLubyte> &out, vec3 &scale, vec3 &offset) {
+    size_t count = positions.size() / 3;
+    bool hasUVs = !uvs.empty();
+    VertexError error = {0, 0, 0};
+
+    out.resize(count * vertexStride(format));
+
+    if (format == FloatFormat) {
+        scale = vec3(1);
+        offset = vec3(0);
+
+        FloatVertex *vertex = (FloatVertex *) &out[0];
+        for (size_t i = 0; i < count; i++) {
+            memcpy(vertex[i].position, &positions[i * 3], sizeof(vertex[i].position));
+            memcpy(vertex[i].normal, &normals[i * 3], sizeof(vertex[i].normal));
+            if (hasUVs)
+                memcpy(vertex[i].uv, &uvs[i * 2], sizeof(vertex[i].uv));
+            else
+                vertex[i].uv[0] = vertex[i].uv[1] = 0;
+            vertex[i].material = materials[i];
+        }
+        return error;
+    }
+
+    //positions are stored relative to the bounding box, so the 16 bits cover only the mesh extent
+    vec3 minimum = vec3(INFINITY), maximum = vec3(-INFINITY);
+    for (size_t i = 0; i < count; i++) {
+        vec3 p = vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+        minimum = min(minimum, p);
+        maximum = max(maximum, p);
+    }
+    if (count == 0)
+        minimum = maximum = vec3(0);
+
+    offset = (minimum + maximum) * 0.5f;
+    scale = max((maximum - minimum) * 0.5f, vec3(1e-6f));
+
+    PackedVertex *vertex = (PackedVertex *) &out[0];
+    for (size_t i = 0; i < count; i++) {
+        vec3 p = vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+        vec3 n = vec3(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]);
+        vec3 q = (p - offset) / scale;
+
+        for (int c = 0; c < 3; c++)
+            vertex[i].position[c] = (GLshort) packSnorm1x16(q[c]);
+        vertex[i].material = materials[i];
+
+        if (length(n) > 0)
+            n = normalize(n);
+        vertex[i].normal = packSnorm3x10_1x2(vec4(n, 0));
+
+        if (hasUVs) {
+            vertex[i].uv[0] = packHalf1x16(uvs[i * 2]);
+            vertex[i].uv[1] = packHalf1x16(uvs[i * 2 + 1]);
+        } else {
+            vertex[i].uv[0] = vertex[i].uv[1] = 0;
+        }
+
+        //measure what the vertex shader will actually see
+        vec3 decoded;
+        for (int c = 0; c < 3; c++)
+            decoded[c] = unpackSnorm1x16((uint16) vertex[i].position[c]) * scale[c] + offset[c];
+        error.position = max(error.position, length(decoded - p));
+
+        if (length(n) > 0) {
+            vec3 decodedNormal = normalize(vec3(unpackSnorm3x10_1x2(vertex[i].normal)));
+            float angle = degrees(acosf(clamp(dot(decodedNormal, n), -1.0f, 1.0f)));
+            error.normalDegrees = max(error.normalDegrees, angle);
+        }
+
+        if (hasUVs) {
+            error.uv = max(error.uv, fabsf(unpackHalf1x16(vertex[i].uv[0]) - uvs[i * 2]));
+            error.uv = max(error.uv, fabsf(unpackHalf1x16(vertex[i].uv[1]) - uvs[i * 2 + 1]));
+        }
+    }
+
+    return error;
+}
+
+void packPositions(VertexFormat format, const std::vector<GLubyte> &vertices, std::vector<GLubyte> &out) {
+    size_t count = vertices.size() / vertexStride(format);
+    out.resize(count * positionStride(format));
+
+    //same encoding as the full vertices, so both passes compute the same depths
+    for (size_t i = 0; i < count; i++) {
+        if (format == PackedFormat) {
+            const PackedVertex &vertex = ((const PackedVertex *) &vertices[0])[i];
+            PackedPosition &position = ((PackedPosition *) &out[0])[i];
+            memcpy(position.position, vertex.position, sizeof(position.position));
+            position.padding = 0;
+        } else {
+            const FloatVertex &vertex = ((const FloatVertex *) &vertices[0])[i];
+            memcpy(&out[i * positionStride(format)], vertex.position, sizeof(vertex.position));
+        }
+    }
+}
+
+void setVertexAttributes(VertexFormat format, bool hasUVs) {
+    GLsizei stride = vertexStride(format);
+
+    stateCache.enableVertexAttribArray(vPosition);
+    stateCache.enableVertexAttribArray(vNormal);
+    stateCache.enableVertexAttribArray(vMaterial);
+
+    if (format == PackedFormat) {
+        stateCache.vertexAttribPointer(vPosition, 3, GL_SHORT, GL_TRUE, stride,
+                                       (void *) offsetof(PackedVertex, position));
+        stateCache.vertexAttribPointer(vNormal, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+                                       (void *) offsetof(PackedVertex, normal));
+        stateCache.vertexAttribIPointer(vMaterial, 1, GL_UNSIGNED_SHORT, stride,
+                                        (void *) offsetof(PackedVertex, material));
+    } else {
+        stateCache.vertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE, stride,
+                                       (void *) offsetof(FloatVertex, position));
+        stateCache.vertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, stride,
+                                       (void *) offsetof(FloatVertex, normal));
+        stateCache.vertexAttribIPointer(vMaterial, 1, GL_UNSIGNED_INT, stride,
+                                        (void *) offsetof(FloatVertex, material));
+    }
+
+    if (hasUVs) {
+        stateCache.enableVertexAttribArray(vUV);
+        if (format == PackedFormat)
+            stateCache.vertexAttribPointer(vUV, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                                           (void *) offsetof(PackedVertex, uv));
+        else
+            stateCache.vertexAttribPointer(vUV, 2, GL_FLOAT, GL_FALSE, stride,
+                                           (void *) offsetof(FloatVertex, uv));
+    } else {
+        //a previous mesh may have left it enabled
+        stateCache.disableVertexAttribArray(vUV);
+    }
+}
+
+void setPositionAttribute(VertexFormat format) {
+    stateCache.enableVertexAttribArray(vPosition);
+    stateCache.disableVertexAttribArray(vNormal);
+    stateCache.disableVertexAttribArray(vMaterial);
+    stateCache.disableVertexAttribArray(vUV);
+
+    if (format == PackedFormat)
+        stateCache.vertexAttribPointer(vPosition, 3, GL_SHORT, GL_TRUE, positionStride(format),
+                                       (void *) offsetof(PackedPosition, position));
+    else
+        stateCache.vertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE, positionStride(format), (void *) 0);
+}
@@ -0,0 +1,79 @@
+#ifndef vFormat
+#define vFormat
+
+#include <vector>
+
+//include GL stuff
+#include <GL/glew.h>
+
+//include GLM stuff
+#define GLM_FORCE_RADIANS
+
+#include "../glm/glm.hpp"
+
+using namespace glm;
+
+/*
+ * Interleaved vertex layouts.
+ * FloatFormat keeps full 32 bit floats (36 bytes per vertex).
+ * PackedFormat quantizes to 16 bytes per vertex: snorm16 positions relative to the mesh bounds
+ * (decoded by the object matrices with PositionScale/PositionOffset), GL_INT_2_10_10_10_REV normals
+ * and half float texture coordinates.
+ * Both carry the index of the vertex's material, relative to the mesh's first material.
+ * The depth pre-pass reads a separate stream with only the positions, in the same encoding.
+ */
+enum VertexFormat {
+    FloatFormat = 0, PackedFormat = 1
+};
+
+struct FloatVertex {
+    GLfloat position[3];
+    GLfloat normal[3];
+    GLfloat uv[2];
+    GLuint material;
+};
+
+struct PackedVertex {
+    GLshort position[3];
+    GLushort material;
+    GLuint normal;
+    GLushort uv[2];
+};
+
+struct PackedPosition {
+    GLshort position[3];
+    GLshort padding;
+};
+
+//attribute locations, matching the layout qualifiers in vertexshader.vs
+enum AttributeLocation {
+    vPosition = 0, vNormal = 1, vUV = 2, vMaterial = 3
+};
+
+//worst case quantization error of a packed mesh
+struct VertexError {
+    float position, normalDegrees, uv;
+};
+
+GLsizei vertexStride(VertexFormat format);
+GLsizei positionStride(VertexFormat format);
+
+/*
+ * Interleaves the vertices from the separate position/normal/uv/material arrays (uvs may be empty)
+ * into out; scale and offset receive the position decode transform.
+ */
+VertexError packVertices(VertexFormat format, const std::vector<GLfloat> &positions,
+                         const std::vector<GLfloat> &normals, const std::vector<GLfloat> &uvs,
+                         const std::vector<GLushort> &materials,
+                         std::vector<GLubyte> &out, vec3 &scale, vec3 &offset);
+
+//copies the positions of interleaved vertices into a position only stream, bit for bit
+void packPositions(VertexFormat format, const std::vector<GLubyte> &vertices, std::vector<GLubyte> &out);
+
+//enables and points the vertex attributes at the currently bound GL_ARRAY_BUFFER
+void setVertexAttributes(VertexFormat format, bool hasUVs);
+
+//enables only the position attribute, pointed at a position stream in the bound GL_ARRAY_BUFFER
+void setPositionAttribute(VertexFormat format);
+
+#endif